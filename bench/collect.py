@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+#
+# Fold the fio JSON files guest.sh left in <results>/raw into one
+# summary.json and print a table comparing every configuration against
+# raw ext4 and against wrapfs (stacking without encryption).
+#
+#	./collect.py <results dir>
+#
+
+import glob
+import json
+import os
+import statistics
+import sys
+
+
+def clat_us(side):
+    """Mean and 99th percentile completion latency in usec."""
+    if "clat_ns" in side:
+        clat, scale = side["clat_ns"], 1000.0
+    else:
+        clat, scale = side.get("clat", {}), 1.0
+    pct = clat.get("percentile", {})
+    p99 = pct.get("99.000000", pct.get("99.00", 0))
+    return clat.get("mean", 0) / scale, p99 / scale
+
+
+def load_run(path):
+    with open(path) as f:
+        job = json.load(f)["jobs"][0]
+    run = {}
+    for rw in ("read", "write"):
+        side = job[rw]
+        if not side.get("io_bytes"):
+            continue
+        mean, p99 = clat_us(side)
+        run[rw] = {
+            "bw_kib": side["bw"],
+            "iops": side["iops"],
+            "clat_mean_us": mean,
+            "clat_p99_us": p99,
+        }
+    return run
+
+
+def median_runs(runs):
+    """Per-field median across repeated runs of one workload."""
+    out = {}
+    for rw in ("read", "write"):
+        sides = [r[rw] for r in runs if rw in r]
+        if sides:
+            out[rw] = {k: statistics.median(s[k] for s in sides)
+                       for k in sides[0]}
+            out[rw]["runs"] = len(sides)
+    return out
+
+
+def read_file(path):
+    try:
+        with open(path) as f:
+            return f.read().strip()
+    except OSError:
+        return None
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: collect.py <results dir>")
+    results = sys.argv[1]
+    raw = os.path.join(results, "raw")
+
+    runs = {}
+    for path in sorted(glob.glob(os.path.join(raw, "*.json"))):
+        config, job, _ = os.path.basename(path).split(".", 2)
+        try:
+            runs.setdefault(config, {}).setdefault(job, []).append(
+                load_run(path))
+        except (ValueError, KeyError) as e:
+            print("skipping %s: %s" % (path, e), file=sys.stderr)
+
+    summary = {
+        "commit": read_file(os.path.join(results, "commit")),
+        "uname": read_file(os.path.join(raw, "uname")),
+        "results": {c: {j: median_runs(r) for j, r in jobs.items()}
+                    for c, jobs in runs.items()},
+    }
+    with open(os.path.join(results, "summary.json"), "w") as f:
+        json.dump(summary, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    res = summary["results"]
+    print("%-8s %-12s %-5s %10s %10s %10s %8s %8s" %
+          ("config", "workload", "rw", "MiB/s", "p99_us", "mean_us",
+           "vs_ext4", "vs_wrap"))
+    for config in sorted(res):
+        for job in sorted(res[config]):
+            for rw, s in sorted(res[config][job].items()):
+                rel = []
+                for base in ("ext4", "wrapfs"):
+                    b = res.get(base, {}).get(job, {}).get(rw)
+                    rel.append("%.2f" % (s["bw_kib"] / b["bw_kib"])
+                               if b and b["bw_kib"] else "-")
+                print("%-8s %-12s %-5s %10.1f %10.1f %10.1f %8s %8s" %
+                      (config, job, rw, s["bw_kib"] / 1024.0,
+                       s["clat_p99_us"], s["clat_mean_us"], rel[0], rel[1]))
+
+
+if __name__ == "__main__":
+    main()
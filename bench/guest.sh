@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Runs inside the benchmark VM (see run-vm.sh).  For every configuration
+# it makes a fresh ext4 on a ramdisk, stacks the file system under test on
+# top, runs each fio job and leaves fio's JSON output in the shared
+# directory.  Can also be run by hand on a test machine:
+#
+#	BENCH_SHARE=/path/to/share ./guest.sh
+#
+
+BENCH_SHARE=${BENCH_SHARE:-/bench}
+. "$BENCH_SHARE/bench.conf"
+
+export BENCH_SIZE BENCH_RUNTIME BENCH_JOBS
+LOWER=/mnt/lower
+UPPER=/mnt/upper
+OUT=$BENCH_SHARE/results/raw
+
+log() {
+	echo "bench: $*" >&2
+}
+
+setup_ramdisk() {
+	if [ ! -b /dev/ram0 ]; then
+		modprobe brd rd_nr=1 rd_size=$((BENCH_RAMDISK_MB * 1024)) ||
+			return 1
+	fi
+	DEV=/dev/ram0
+}
+
+# $1: configuration name; sets BENCH_DIR to the directory fio works in
+mount_config() {
+	mkfs.ext4 -q -F "$DEV" || return 1
+	mkdir -p $LOWER $UPPER
+	mount -t ext4 "$DEV" $LOWER || return 1
+	case $1 in
+	ext4)
+		BENCH_DIR=$LOWER
+		;;
+	wrapfs|xcfs)
+		mount -t "$1" $LOWER $UPPER || return 1
+		BENCH_DIR=$UPPER
+		;;
+	esac
+	export BENCH_DIR
+}
+
+umount_config() {
+	mountpoint -q $UPPER && umount $UPPER
+	umount $LOWER
+}
+
+main() {
+	setup_ramdisk || { log "no ramdisk"; return 1; }
+	mkdir -p "$OUT"
+	uname -a > "$OUT/uname"
+
+	insmod "$BENCH_SHARE/modules/wrapfs.ko" || return 1
+	insmod "$BENCH_SHARE/modules/xcfs.ko" || return 1
+
+	for config in $BENCH_CONFIGS; do
+		for job in $BENCH_WORKLOADS; do
+			for run in $(seq 1 "$BENCH_REPEAT"); do
+				log "$config $job run $run"
+				mount_config "$config" || return 1
+				sync
+				echo 3 > /proc/sys/vm/drop_caches
+				(cd "$BENCH_SHARE/fio" &&
+				 fio --output-format=json \
+				     --output="$OUT/$config.$job.$run.json" \
+				     "$job.fio") || log "$config $job failed"
+				umount_config
+			done
+		done
+	done
+
+	rmmod xcfs wrapfs
+}
+
+main
+status=$?
+echo $status > "$OUT/status"
+# when we are the VM's init, there is nothing to return to
+[ $$ -eq 1 ] && poweroff -f
+exit $status
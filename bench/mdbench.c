@@ -0,0 +1,432 @@
+/*
+ * mdbench - metadata microbenchmark for stacked file systems.
+ *
+ * Runs stat storms, open/close loops, create/unlink churn and deep path
+ * walks from a growing number of threads against one directory, and
+ * reports ops/sec and per-op latency for each thread count.  Run it once
+ * on an xcfs mount and once on the lower directory to see what stacking
+ * costs, and whether that cost grows with the thread count.
+ *
+ *	mdbench [-t 1,2,4,8] [-n files] [-D depth] [-s secs] [-w list]
+ *		[-c] [-k] [-j] <dir>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS	256
+/* log2 buckets of nanoseconds, the last one open ended */
+#define LAT_BUCKETS	40
+
+enum workload {
+	W_STAT,		/* stat() of random files in one directory */
+	W_OPEN,		/* open()+close() of random files */
+	W_CREATE,	/* create+unlink in one shared directory */
+	W_WALK,		/* stat() of a file at the bottom of a deep path */
+	W_NR,
+};
+
+static const char *const workload_names[W_NR] = {
+	[W_STAT]	= "stat",
+	[W_OPEN]	= "open",
+	[W_CREATE]	= "create",
+	[W_WALK]	= "walk",
+};
+
+struct thread {
+	pthread_t tid;
+	int id;
+	enum workload w;
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t sum_ns;
+	uint64_t hist[LAT_BUCKETS];
+};
+
+static char *base;
+static int nfiles = 10000;
+static int depth = 32;
+static int seconds = 5;
+static int drop_caches;
+static int json;
+
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+static struct thread threads[MAX_THREADS];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ilog2_u64(uint64_t v)
+{
+	return v ? 63 - __builtin_clzll(v) : 0;
+}
+
+static void die(const char *what, const char *path)
+{
+	fprintf(stderr, "mdbench: %s %s: %s\n", what, path ? path : "",
+		strerror(errno));
+	exit(1);
+}
+
+static void file_path(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "%s/mdbench/files/f%d", base, i);
+}
+
+static void walk_path(char *buf, size_t len)
+{
+	int n, i;
+
+	n = snprintf(buf, len, "%s/mdbench/deep", base);
+	for (i = 0; i < depth; i++)
+		n += snprintf(buf + n, len - n, "/d%d", i);
+	snprintf(buf + n, len - n, "/leaf");
+}
+
+static void make_dir(const char *path)
+{
+	if (mkdir(path, 0755) && errno != EEXIST)
+		die("mkdir", path);
+}
+
+static void setup(void)
+{
+	char path[PATH_MAX];
+	int i, fd, n;
+
+	snprintf(path, sizeof(path), "%s/mdbench", base);
+	make_dir(path);
+	snprintf(path, sizeof(path), "%s/mdbench/files", base);
+	make_dir(path);
+	snprintf(path, sizeof(path), "%s/mdbench/churn", base);
+	make_dir(path);
+
+	for (i = 0; i < nfiles; i++) {
+		file_path(path, sizeof(path), i);
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			die("create", path);
+		close(fd);
+	}
+
+	n = snprintf(path, sizeof(path), "%s/mdbench/deep", base);
+	make_dir(path);
+	for (i = 0; i < depth; i++) {
+		n += snprintf(path + n, sizeof(path) - n, "/d%d", i);
+		make_dir(path);
+	}
+	snprintf(path + n, sizeof(path) - n, "/leaf");
+	fd = open(path, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0)
+		die("create", path);
+	close(fd);
+}
+
+static void cleanup(void)
+{
+	char path[PATH_MAX];
+	char *slash;
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		file_path(path, sizeof(path), i);
+		unlink(path);
+	}
+	walk_path(path, sizeof(path));
+	unlink(path);
+	for (i = depth; i > 0; i--) {
+		/* chop one component off the end */
+		slash = strrchr(path, '/');
+		*slash = '\0';
+		rmdir(path);
+	}
+	snprintf(path, sizeof(path), "%s/mdbench/deep", base);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/mdbench/files", base);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/mdbench/churn", base);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/mdbench", base);
+	rmdir(path);
+}
+
+static void do_drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		die("drop caches", NULL);
+	close(fd);
+}
+
+/* one operation of @t's workload; returns 0 or -1 */
+static int one_op(struct thread *t, unsigned int *seed, uint64_t seq)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	switch (t->w) {
+	case W_STAT:
+		file_path(path, sizeof(path), rand_r(seed) % nfiles);
+		return stat(path, &st);
+	case W_OPEN:
+		file_path(path, sizeof(path), rand_r(seed) % nfiles);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return -1;
+		return close(fd);
+	case W_CREATE:
+		snprintf(path, sizeof(path), "%s/mdbench/churn/t%d.%llu",
+			 base, t->id, (unsigned long long)seq);
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0)
+			return -1;
+		close(fd);
+		return unlink(path);
+	case W_WALK:
+		walk_path(path, sizeof(path));
+		return stat(path, &st);
+	default:
+		return -1;
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct thread *t = arg;
+	unsigned int seed = t->id * 7919 + 1;
+	uint64_t start, ns;
+	int b;
+
+	pthread_barrier_wait(&start_barrier);
+	while (!stop) {
+		start = now_ns();
+		if (one_op(t, &seed, t->ops + t->errors))
+			t->errors++;
+		else
+			t->ops++;
+		ns = now_ns() - start;
+		t->sum_ns += ns;
+		b = ilog2_u64(ns);
+		t->hist[b < LAT_BUCKETS ? b : LAT_BUCKETS - 1]++;
+	}
+	return NULL;
+}
+
+/* upper bound, in ns, of the bucket holding the @pct'th percentile */
+static uint64_t percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t want = (uint64_t)(total * pct / 100.0), seen = 0;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return (1ULL << (b + 1)) - 1;
+	}
+	return 1ULL << LAT_BUCKETS;
+}
+
+static void run(enum workload w, int nthreads, int *first)
+{
+	uint64_t hist[LAT_BUCKETS] = { 0 }, ops = 0, errors = 0, sum_ns = 0;
+	uint64_t start, elapsed;
+	double rate;
+	int i, b;
+
+	if (drop_caches)
+		do_drop_caches();
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		memset(&threads[i], 0, sizeof(threads[i]));
+		threads[i].id = i;
+		threads[i].w = w;
+		if (pthread_create(&threads[i].tid, NULL, worker, &threads[i])) {
+			errno = EAGAIN;
+			die("pthread_create", NULL);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].tid, NULL);
+	elapsed = now_ns() - start;
+	pthread_barrier_destroy(&start_barrier);
+
+	for (i = 0; i < nthreads; i++) {
+		ops += threads[i].ops;
+		errors += threads[i].errors;
+		sum_ns += threads[i].sum_ns;
+		for (b = 0; b < LAT_BUCKETS; b++)
+			hist[b] += threads[i].hist[b];
+	}
+	rate = ops * 1e9 / elapsed;
+
+	if (json) {
+		printf("%s\n  {\"workload\": \"%s\", \"threads\": %d, "
+		       "\"ops\": %llu, \"errors\": %llu, "
+		       "\"ops_per_sec\": %.0f, \"ops_per_sec_per_thread\": %.0f, "
+		       "\"lat_mean_ns\": %llu, \"lat_p50_ns\": %llu, "
+		       "\"lat_p99_ns\": %llu, \"lat_p999_ns\": %llu}",
+		       *first ? "" : ",", workload_names[w], nthreads,
+		       (unsigned long long)ops, (unsigned long long)errors,
+		       rate, rate / nthreads,
+		       (unsigned long long)(ops + errors ?
+					    sum_ns / (ops + errors) : 0),
+		       (unsigned long long)percentile(hist, ops + errors, 50),
+		       (unsigned long long)percentile(hist, ops + errors, 99),
+		       (unsigned long long)percentile(hist, ops + errors, 99.9));
+	} else {
+		printf("%-8s %7d %12.0f %12.0f %10llu %10llu %10llu %8llu\n",
+		       workload_names[w], nthreads, rate, rate / nthreads,
+		       (unsigned long long)(ops + errors ?
+					    sum_ns / (ops + errors) : 0),
+		       (unsigned long long)percentile(hist, ops + errors, 50),
+		       (unsigned long long)percentile(hist, ops + errors, 99),
+		       (unsigned long long)errors);
+	}
+	fflush(stdout);
+	*first = 0;
+}
+
+static int parse_threads(const char *arg, int *list)
+{
+	char *copy = strdup(arg), *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(copy, ",", &save); tok && n < MAX_THREADS;
+	     tok = strtok_r(NULL, ",", &save)) {
+		list[n] = atoi(tok);
+		if (list[n] < 1 || list[n] > MAX_THREADS) {
+			fprintf(stderr, "mdbench: bad thread count %s\n", tok);
+			exit(1);
+		}
+		n++;
+	}
+	free(copy);
+	return n;
+}
+
+static unsigned int parse_workloads(const char *arg)
+{
+	char *copy = strdup(arg), *tok, *save;
+	unsigned int mask = 0;
+	int w;
+
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (w = 0; w < W_NR; w++)
+			if (!strcmp(tok, workload_names[w]))
+				break;
+		if (w == W_NR) {
+			fprintf(stderr, "mdbench: unknown workload %s\n", tok);
+			exit(1);
+		}
+		mask |= 1U << w;
+	}
+	free(copy);
+	return mask;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mdbench [options] <dir>\n"
+		"  -t list   thread counts, default 1,2,4,8,16\n"
+		"  -n files  files in the stat/open directory, default %d\n"
+		"  -D depth  directories in the walk path, default %d\n"
+		"  -s secs   seconds per run, default %d\n"
+		"  -w list   workloads out of stat,open,create,walk\n"
+		"  -c        drop caches before each run (needs root)\n"
+		"  -k        keep the test tree afterwards\n"
+		"  -j        print JSON instead of a table\n",
+		nfiles, depth, seconds);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int thread_list[MAX_THREADS], nthread_list;
+	unsigned int mask = (1U << W_NR) - 1;
+	int keep = 0, first = 1, opt, i;
+	enum workload w;
+
+	nthread_list = parse_threads("1,2,4,8,16", thread_list);
+	while ((opt = getopt(argc, argv, "t:n:D:s:w:ckj")) != -1) {
+		switch (opt) {
+		case 't':
+			nthread_list = parse_threads(optarg, thread_list);
+			break;
+		case 'n':
+			nfiles = atoi(optarg);
+			break;
+		case 'D':
+			depth = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'w':
+			mask = parse_workloads(optarg);
+			break;
+		case 'c':
+			drop_caches = 1;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || nfiles < 1 || depth < 0 || seconds < 1)
+		usage();
+	base = argv[optind];
+
+	setup();
+	if (json)
+		printf("{\"dir\": \"%s\", \"files\": %d, \"depth\": %d, "
+		       "\"seconds\": %d, \"results\": [", base, nfiles, depth,
+		       seconds);
+	else
+		printf("%-8s %7s %12s %12s %10s %10s %10s %8s\n",
+		       "workload", "threads", "ops/s", "ops/s/thr",
+		       "mean_ns", "p50_ns", "p99_ns", "errors");
+	for (w = 0; w < W_NR; w++) {
+		if (!(mask & (1U << w)))
+			continue;
+		for (i = 0; i < nthread_list; i++)
+			run(w, thread_list[i], &first);
+	}
+	if (json)
+		printf("\n]}\n");
+	if (!keep)
+		cleanup();
+	return 0;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Build wrapfs and xcfs against a 4.15 kernel tree, boot that kernel in
+# QEMU and run the fio suite inside it.  The VM reuses the host's root
+# file system read-only over 9p, so fio, mkfs.ext4 and a shell only need
+# to be installed on the host.  Results end up in $OUT/results.
+#
+#	KDIR=~/linux-4.15 ./run-vm.sh [output dir]
+#
+# The guest kernel needs, built in: VIRTIO_PCI, NET_9P_VIRTIO, 9P_FS,
+# EXT4_FS, BLK_DEV_RAM, DEVTMPFS and TMPFS.
+#
+
+set -e
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$BENCH")
+KDIR=${KDIR:?set KDIR to a built linux 4.15 tree}
+KERNEL=${KERNEL:-$KDIR/arch/x86/boot/bzImage}
+QEMU=${QEMU:-qemu-system-x86_64}
+VM_CPUS=${VM_CPUS:-4}
+VM_MEM=${VM_MEM:-4G}
+OUT=${1:-$BENCH/out/$(date +%Y%m%d-%H%M%S)}
+
+. "$BENCH/bench.conf"
+
+mkdir -p "$OUT/modules" "$OUT/results"
+cp "$BENCH/bench.conf" "$BENCH/guest.sh" "$OUT/"
+cp -r "$BENCH/fio" "$OUT/"
+
+# out-of-tree builds, so the source directories stay clean
+for fs in wrapfs_kernel_v4.15 xcfs_v4.15; do
+	build="$OUT/build/$fs"
+	mkdir -p "$build"
+	cp "$REPO/$fs"/*.[ch] "$REPO/$fs/Makefile" "$build/"
+	make -C "$KDIR" M="$build" modules
+	cp "$build"/*.ko "$OUT/modules/"
+done
+
+git -C "$REPO" describe --always --dirty > "$OUT/results/commit" || true
+
+"$QEMU" -enable-kvm -cpu host -smp "$VM_CPUS" -m "$VM_MEM" \
+	-nographic -no-reboot \
+	-kernel "$KERNEL" \
+	-append "root=/dev/root rootfstype=9p rootflags=trans=virtio ro \
+console=ttyS0 init=$BENCH/vm-init.sh \
+brd.rd_nr=1 brd.rd_size=$((BENCH_RAMDISK_MB * 1024))" \
+	-fsdev local,id=root,path=/,security_model=none,readonly \
+	-device virtio-9p-pci,fsdev=root,mount_tag=/dev/root \
+	-fsdev local,id=bench,path="$OUT",security_model=none \
+	-device virtio-9p-pci,fsdev=bench,mount_tag=bench
+
+status=$(cat "$OUT/results/raw/status" 2>/dev/null || echo 1)
+if [ "$status" != 0 ]; then
+	echo "benchmark failed in the VM, see $OUT/results/raw" >&2
+	exit 1
+fi
+"$BENCH/collect.py" "$OUT/results"
@@ -0,0 +1,15 @@
+#!/bin/sh
+#
+# init for the benchmark VM.  The host's root is the VM's read-only root
+# (see run-vm.sh); the output directory is shared as "bench".
+#
+
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t devtmpfs devtmpfs /dev
+mount -t tmpfs tmpfs /tmp
+mount -t tmpfs tmpfs /mnt
+mkdir -p /mnt/share
+mount -t 9p -o trans=virtio,version=9p2000.L bench /mnt/share
+
+BENCH_SHARE=/mnt/share exec /mnt/share/guest.sh
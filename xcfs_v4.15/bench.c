@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/module.h>
+#include <linux/math64.h>
+
+/*
+ * Load-time cipher selection, after the raid6 and xor code: with
+ * bench=1, init_xcfs_fs() times every implementation over a few MB and
+ * switches to the fastest.  The numbers are logged and kept for
+ * /sys/fs/xcfs/cipher/bench.  Without it the built-in default stays.
+ */
+static bool xcfs_cipher_bench_enabled;
+module_param_named(bench, xcfs_cipher_bench_enabled, bool, 0444);
+MODULE_PARM_DESC(bench, "Benchmark the ciphers at load and use the fastest");
+
+/* buffer the benchmark runs over: 16K, so it stays in cache */
+#define XCFS_BENCH_ORDER	2
+/* bytes encrypted and decrypted per round */
+#define XCFS_BENCH_BYTES	(4 << 20)
+/* best of this many rounds counts */
+#define XCFS_BENCH_ROUNDS	3
+
+/* MB/s per entry of xcfs_cipher_impls[], 0 if not benchmarked */
+unsigned long xcfs_cipher_bench_mbps[XCFS_CIPHER_BENCH_MAX];
+
+static unsigned long xcfs_cipher_measure(const struct xcfs_cipher_impl *impl,
+					 u8 *buf, size_t len)
+{
+	u64 best = U64_MAX, start, ns;
+	int round, i;
+
+	for (round = 0; round < XCFS_BENCH_ROUNDS; round++) {
+		start = ktime_get_ns();
+		for (i = 0; i < XCFS_BENCH_BYTES / len; i++) {
+			impl->encrypt(buf, len);
+			impl->decrypt(buf, len);
+		}
+		ns = ktime_get_ns() - start;
+		best = min(best, ns);
+		cond_resched();
+	}
+	return div64_u64((2ULL * XCFS_BENCH_BYTES >> 20) * NSEC_PER_SEC,
+			 max_t(u64, best, 1));
+}
+
+void xcfs_cipher_select(void)
+{
+	const struct xcfs_cipher_impl *impl, *fastest = NULL;
+	unsigned long mbps, best = 0;
+	u8 *buf;
+	int i;
+
+	if (!xcfs_cipher_bench_enabled)
+		return;
+	buf = (u8 *)__get_free_pages(GFP_KERNEL, XCFS_BENCH_ORDER);
+	if (!buf) {
+		pr_warn("xcfs: no memory for the cipher benchmark\n");
+		return;
+	}
+	memset(buf, 0xa5, PAGE_SIZE << XCFS_BENCH_ORDER);
+
+	for (i = 0; i < XCFS_CIPHER_BENCH_MAX && xcfs_cipher_impls[i]; i++) {
+		impl = xcfs_cipher_impls[i];
+		mbps = xcfs_cipher_measure(impl, buf,
+					   PAGE_SIZE << XCFS_BENCH_ORDER);
+		xcfs_cipher_bench_mbps[i] = mbps;
+		pr_info("xcfs: cipher %-8s %6lu MB/s\n", impl->name, mbps);
+		if (mbps > best) {
+			best = mbps;
+			fastest = impl;
+		}
+	}
+	free_pages((unsigned long)buf, XCFS_BENCH_ORDER);
+
+	if (fastest) {
+		xcfs_cipher = fastest;
+		pr_info("xcfs: using cipher %s\n", fastest->name);
+	}
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "cipher.h"
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
+/* the tools build every implementation, the module what Kconfig says */
+#if defined(CONFIG_XCFS_CIPHER_SWAR) || !defined(__KERNEL__)
+#define XCFS_HAVE_SWAR
+#endif
+
+/* one byte at a time, as the cipher was first written */
+static void xcfs_encrypt_byte(u8 *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		data[i]++;
+}
+
+static void xcfs_decrypt_byte(u8 *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		data[i]--;
+}
+
+static const struct xcfs_cipher_impl xcfs_cipher_byte = {
+	.name		= "byte",
+	.encrypt	= xcfs_encrypt_byte,
+	.decrypt	= xcfs_decrypt_byte,
+};
+
+#ifdef XCFS_HAVE_SWAR
+/*
+ * Eight bytes per step in a u64 ("SIMD within a register").  Bit 7 of
+ * each byte is masked off or forced on so no carry or borrow crosses a
+ * byte boundary, and the right top bit is put back with an xor:
+ *
+ *	x + 0x01 per byte = ((x & ~H) + L) ^ (x & H)
+ *	x - 0x01 per byte = ((x | H) - L) ^ (~x & H)
+ *
+ * The unaligned head and the tail go through the byte loop.
+ */
+#define XCFS_SWAR_L	0x0101010101010101ULL
+#define XCFS_SWAR_H	0x8080808080808080ULL
+
+static inline u64 xcfs_swar_inc(u64 x)
+{
+	return ((x & ~XCFS_SWAR_H) + XCFS_SWAR_L) ^ (x & XCFS_SWAR_H);
+}
+
+static inline u64 xcfs_swar_dec(u64 x)
+{
+	return ((x | XCFS_SWAR_H) - XCFS_SWAR_L) ^ (~x & XCFS_SWAR_H);
+}
+
+static size_t xcfs_swar_head(const u8 *data, size_t len)
+{
+	size_t head = -(unsigned long)data & (sizeof(u64) - 1);
+
+	return head < len ? head : len;
+}
+
+static void xcfs_encrypt_swar(u8 *data, size_t len)
+{
+	size_t head = xcfs_swar_head(data, len);
+	u64 *w;
+	size_t n;
+
+	xcfs_encrypt_byte(data, head);
+	data += head;
+	len -= head;
+	w = (u64 *)data;
+	for (n = len / sizeof(u64); n >= 4; n -= 4, w += 4) {
+		w[0] = xcfs_swar_inc(w[0]);
+		w[1] = xcfs_swar_inc(w[1]);
+		w[2] = xcfs_swar_inc(w[2]);
+		w[3] = xcfs_swar_inc(w[3]);
+	}
+	for (; n; n--, w++)
+		*w = xcfs_swar_inc(*w);
+	xcfs_encrypt_byte((u8 *)w, len & (sizeof(u64) - 1));
+}
+
+static void xcfs_decrypt_swar(u8 *data, size_t len)
+{
+	size_t head = xcfs_swar_head(data, len);
+	u64 *w;
+	size_t n;
+
+	xcfs_decrypt_byte(data, head);
+	data += head;
+	len -= head;
+	w = (u64 *)data;
+	for (n = len / sizeof(u64); n >= 4; n -= 4, w += 4) {
+		w[0] = xcfs_swar_dec(w[0]);
+		w[1] = xcfs_swar_dec(w[1]);
+		w[2] = xcfs_swar_dec(w[2]);
+		w[3] = xcfs_swar_dec(w[3]);
+	}
+	for (; n; n--, w++)
+		*w = xcfs_swar_dec(*w);
+	xcfs_decrypt_byte((u8 *)w, len & (sizeof(u64) - 1));
+}
+
+static const struct xcfs_cipher_impl xcfs_cipher_swar = {
+	.name		= "swar",
+	.encrypt	= xcfs_encrypt_swar,
+	.decrypt	= xcfs_decrypt_swar,
+};
+#endif	/* XCFS_HAVE_SWAR */
+
+const struct xcfs_cipher_impl *const xcfs_cipher_impls[] = {
+	&xcfs_cipher_byte,
+#ifdef XCFS_HAVE_SWAR
+	&xcfs_cipher_swar,
+#endif
+	NULL,
+};
+
+#ifdef XCFS_HAVE_SWAR
+const struct xcfs_cipher_impl *xcfs_cipher = &xcfs_cipher_swar;
+#else
+const struct xcfs_cipher_impl *xcfs_cipher = &xcfs_cipher_byte;
+#endif
+
+const struct xcfs_cipher_impl *xcfs_cipher_find(const char *name)
+{
+	int i;
+
+	for (i = 0; xcfs_cipher_impls[i]; i++)
+		if (!strcmp(xcfs_cipher_impls[i]->name, name))
+			return xcfs_cipher_impls[i];
+	return NULL;
+}
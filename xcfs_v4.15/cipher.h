@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * The xcfs cipher: every byte is shifted by one on the way down to the
+ * lower file system and back on the way up.  This header and cipher.c
+ * build both in the module and as a userspace library (see tools/), so
+ * implementations can be benchmarked and checked against each other
+ * without loading anything.
+ */
+
+#ifndef _XCFS_CIPHER_H_
+#define _XCFS_CIPHER_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+typedef uint8_t u8;
+typedef uint64_t u64;
+#endif
+
+struct xcfs_cipher_impl {
+	const char *name;
+	void (*encrypt)(u8 *data, size_t len);
+	void (*decrypt)(u8 *data, size_t len);
+};
+
+/* all implementations, NULL terminated; the first is the reference */
+extern const struct xcfs_cipher_impl *const xcfs_cipher_impls[];
+/* the selected one, used by mounts without cipher= */
+extern const struct xcfs_cipher_impl *xcfs_cipher;
+
+extern const struct xcfs_cipher_impl *xcfs_cipher_find(const char *name);
+
+#endif	/* not _XCFS_CIPHER_H_ */
@@ -10,33 +10,103 @@
  */
 
 #include "xcfs.h"
+#include "xcfs_trace.h"
+
+/*
+ * A lower unlink or rename leaves our lower dentry in place: it is only
+ * unhashed, or moved to another directory or name, and keeps its inode.
+ * So check it still sits where @dentry does, under @dentry's parent's
+ * lower dentry and with the same name.  Lock-free; the caller retries
+ * if either dentry's d_seq changed meanwhile.
+ */
+static bool xcfs_lower_moved(struct dentry *dentry,
+			     struct dentry *lower_dentry)
+{
+	struct dentry *parent = READ_ONCE(dentry->d_parent);
+	struct dentry *lower_parent = READ_ONCE(lower_dentry->d_parent);
+	struct xcfs_dentry_info *parent_info = READ_ONCE(parent->d_fsdata);
+	struct inode *inode = d_inode_rcu(dentry);
+	unsigned int len;
+
+	/* the lower name now refers to another inode (or none) */
+	if (d_inode_rcu(lower_dentry) !=
+	    (inode ? xcfs_lower_inode(inode) : NULL))
+		return true;
+	/* lower file system roots are never hashed */
+	if (IS_ROOT(dentry))
+		return false;
+	if (d_unhashed(lower_dentry))
+		return true;
+	if (!parent_info ||
+	    lower_parent != READ_ONCE(parent_info->lower_dentry))
+		return true;
+	/* names a lower ->d_compare matches need not be bytewise equal */
+	if (lower_parent->d_flags & DCACHE_OP_COMPARE)
+		return false;
+	len = READ_ONCE(dentry->d_name.len);
+	return READ_ONCE(lower_dentry->d_name.len) != len ||
+	       memcmp(READ_ONCE(lower_dentry->d_name.name),
+		      READ_ONCE(dentry->d_name.name), len);
+}
 
 /*
  * returns: -ERRNO if error (returned to user)
  *          0: tell VFS to invalidate dentry
  *          1: dentry is valid
+ *
+ * Nothing here sleeps until the lower ->d_revalidate, so RCU-walk is
+ * served too; our dentry private data is freed after a grace period.
  */
 static int xcfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 {
-	struct path lower_path;
-	struct dentry *lower_dentry;
+	struct xcfs_dentry_info *info;
+	struct dentry *lower_dentry = NULL;
+	unsigned int seq, lower_seq;
+	bool moved;
 	int err = 1;
 
-	if (flags & LOOKUP_RCU)
-		return -ECHILD;
-
-	xcfs_get_lower_path(dentry, &lower_path);
-	lower_dentry = lower_path.dentry;
+	rcu_read_lock();
+	info = READ_ONCE(dentry->d_fsdata);
+	if (info)
+		lower_dentry = READ_ONCE(info->lower_dentry);
+	/* being killed under an RCU walk */
+	if (!lower_dentry) {
+		rcu_read_unlock();
+		err = (flags & LOOKUP_RCU) ? -ECHILD : 0;
+		goto out;
+	}
+	for (;;) {
+		seq = raw_seqcount_begin(&dentry->d_seq);
+		lower_seq = raw_seqcount_begin(&lower_dentry->d_seq);
+		moved = xcfs_lower_moved(dentry, lower_dentry);
+		if (!read_seqcount_retry(&dentry->d_seq, seq) &&
+		    !read_seqcount_retry(&lower_dentry->d_seq, lower_seq))
+			break;
+		if (flags & LOOKUP_RCU) {
+			rcu_read_unlock();
+			err = -ECHILD;
+			goto out;
+		}
+	}
+	rcu_read_unlock();
+	if (moved) {
+		err = 0;
+		goto out;
+	}
 	if (!(lower_dentry->d_flags & DCACHE_OP_REVALIDATE))
 		goto out;
 	err = lower_dentry->d_op->d_revalidate(lower_dentry, flags);
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	/* the name may change under an RCU walk, don't copy it out */
+	if (!(flags & LOOKUP_RCU))
+		trace_xcfs_d_revalidate(dentry, flags, err);
 	return err;
 }
 
 static void xcfs_d_release(struct dentry *dentry)
 {
+	if (!XCFS_D(dentry))
+		return;
 	/* release and reset the lower paths */
 	xcfs_put_reset_lower_path(dentry);
 	free_dentry_private_data(dentry);
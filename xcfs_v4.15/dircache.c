@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/module.h>
+
+/*
+ * Optional in-memory cache of decoded directory entries.  A listing that
+ * starts at offset 0 reads the whole lower directory once into a flat
+ * buffer hung off the upper inode; later listings are served from it
+ * until the lower directory's mtime or i_version changes, or until xcfs
+ * itself changes the directory.  Each entry keeps the lower offset it
+ * was read at, and listings from the cache hand out those offsets, so
+ * f_pos, telldir cookies and nfsd's d_off mean the same with or without
+ * the cache and a listing can resume on the lower directory.
+ */
+static bool xcfs_dircache_enabled;
+module_param_named(dircache, xcfs_dircache_enabled, bool, 0644);
+MODULE_PARM_DESC(dircache, "Cache directory listings in memory");
+
+/*
+ * Installed caches sit on a global LRU; once together they pin more
+ * than dircache_mb, the least recently listed directories lose theirs.
+ */
+static unsigned int xcfs_dircache_mb = 64;
+module_param_named(dircache_mb, xcfs_dircache_mb, uint, 0644);
+MODULE_PARM_DESC(dircache_mb, "Memory all cached listings may use, in MiB");
+
+static DEFINE_SPINLOCK(xcfs_dircache_lru_lock);	/* nests in i_lock */
+static LIST_HEAD(xcfs_dircache_lru);
+static size_t xcfs_dircache_bytes;
+
+/* never cache directories whose decoded entries exceed this */
+#define XCFS_DIRCACHE_MAX_BYTES	(16 << 20)
+
+struct xcfs_dir_entry {
+	u64 ino;
+	loff_t pos;		/* lower offset of this entry */
+	u16 namelen;
+	u8 type;
+	char name[];
+};
+
+struct xcfs_dir_cache {
+	struct kref ref;
+	struct timespec mtime;	/* lower directory stamp when filled */
+	u64 version;
+	unsigned int count;	/* number of entries */
+	loff_t end_pos;		/* lower offset past the last entry */
+	u32 *offsets;		/* entry index -> offset in buf */
+	size_t size;		/* bytes used in buf */
+	size_t alloc;
+	char *buf;
+	struct list_head lru;	/* on xcfs_dircache_lru while installed */
+	struct inode *dir;
+	size_t bytes;		/* memory charged to the budget */
+};
+
+struct xcfs_dircache_fill {
+	struct dir_context ctx;
+	struct xcfs_dir_cache *dc;
+	int err;
+};
+
+static void xcfs_dircache_release(struct kref *ref)
+{
+	struct xcfs_dir_cache *dc = container_of(ref, struct xcfs_dir_cache,
+						 ref);
+
+	kvfree(dc->offsets);
+	kvfree(dc->buf);
+	kfree(dc);
+}
+
+static inline void xcfs_dircache_put(struct xcfs_dir_cache *dc)
+{
+	if (dc)
+		kref_put(&dc->ref, xcfs_dircache_release);
+}
+
+static inline size_t xcfs_dircache_budget(void)
+{
+	return (size_t)READ_ONCE(xcfs_dircache_mb) << 20;
+}
+
+/*
+ * Install @dc (may be NULL) as the directory's cache and return the old
+ * one, whose reference passes to the caller.  Keeps the LRU and the
+ * byte count in step with what the inodes hold.
+ */
+static struct xcfs_dir_cache *xcfs_dircache_swap(struct inode *dir,
+						 struct xcfs_dir_cache *dc)
+{
+	struct xcfs_dir_cache *old;
+
+	spin_lock(&dir->i_lock);
+	old = XCFS_I(dir)->dir_cache;
+	XCFS_I(dir)->dir_cache = dc;
+	if (old || dc) {
+		spin_lock(&xcfs_dircache_lru_lock);
+		if (old) {
+			list_del_init(&old->lru);
+			xcfs_dircache_bytes -= old->bytes;
+		}
+		if (dc) {
+			dc->dir = dir;
+			list_add_tail(&dc->lru, &xcfs_dircache_lru);
+			xcfs_dircache_bytes += dc->bytes;
+		}
+		spin_unlock(&xcfs_dircache_lru_lock);
+	}
+	spin_unlock(&dir->i_lock);
+	return old;
+}
+
+/* drop least recently listed caches until we are back under budget */
+static void xcfs_dircache_trim(void)
+{
+	size_t budget = xcfs_dircache_budget();
+	struct xcfs_dir_cache *dc, *next;
+	LIST_HEAD(dispose);
+
+	spin_lock(&xcfs_dircache_lru_lock);
+	list_for_each_entry_safe(dc, next, &xcfs_dircache_lru, lru) {
+		if (xcfs_dircache_bytes <= budget)
+			break;
+		/* wrong lock order; skip directories busy right now */
+		if (!spin_trylock(&dc->dir->i_lock))
+			continue;
+		XCFS_I(dc->dir)->dir_cache = NULL;
+		spin_unlock(&dc->dir->i_lock);
+		list_move(&dc->lru, &dispose);
+		xcfs_dircache_bytes -= dc->bytes;
+	}
+	spin_unlock(&xcfs_dircache_lru_lock);
+
+	list_for_each_entry_safe(dc, next, &dispose, lru) {
+		list_del_init(&dc->lru);
+		xcfs_dircache_put(dc);
+	}
+}
+
+static bool xcfs_dircache_valid(struct xcfs_dir_cache *dc,
+				struct inode *lower_dir)
+{
+	return timespec_equal(&dc->mtime, &lower_dir->i_mtime) &&
+	       dc->version == lower_dir->i_version;
+}
+
+/* returns a referenced cache if the inode has a valid one */
+static struct xcfs_dir_cache *xcfs_dircache_get(struct inode *dir)
+{
+	struct xcfs_dir_cache *dc;
+
+	spin_lock(&dir->i_lock);
+	dc = XCFS_I(dir)->dir_cache;
+	if (dc && xcfs_dircache_valid(dc, xcfs_lower_inode(dir))) {
+		kref_get(&dc->ref);
+		spin_lock(&xcfs_dircache_lru_lock);
+		list_move_tail(&dc->lru, &xcfs_dircache_lru);
+		spin_unlock(&xcfs_dircache_lru_lock);
+	} else {
+		dc = NULL;
+	}
+	spin_unlock(&dir->i_lock);
+	return dc;
+}
+
+/* drop the cached listing, e.g. after we changed the directory */
+void xcfs_dircache_invalidate(struct inode *dir)
+{
+	struct xcfs_dir_cache *dc;
+
+	if (!READ_ONCE(XCFS_I(dir)->dir_cache))
+		return;
+	dc = xcfs_dircache_swap(dir, NULL);
+	xcfs_dircache_put(dc);
+}
+
+static int xcfs_dircache_filldir(struct dir_context *ctx, const char *name,
+				 int namelen, loff_t offset, u64 ino,
+				 unsigned int d_type)
+{
+	struct xcfs_dircache_fill *fill =
+		container_of(ctx, struct xcfs_dircache_fill, ctx);
+	struct xcfs_dir_cache *dc = fill->dc;
+	struct xcfs_dir_entry *de;
+	size_t reclen = ALIGN(sizeof(*de) + namelen, sizeof(u64));
+
+	if (dc->size + reclen > dc->alloc) {
+		size_t alloc = max_t(size_t, dc->alloc * 2, PAGE_SIZE);
+		char *buf;
+
+		if (alloc > XCFS_DIRCACHE_MAX_BYTES ||
+		    alloc > xcfs_dircache_budget()) {
+			fill->err = -EFBIG;
+			return -EFBIG;
+		}
+		buf = kvmalloc(alloc, GFP_KERNEL);
+		if (!buf) {
+			fill->err = -ENOMEM;
+			return -ENOMEM;
+		}
+		if (dc->buf)
+			memcpy(buf, dc->buf, dc->size);
+		kvfree(dc->buf);
+		dc->buf = buf;
+		dc->alloc = alloc;
+	}
+
+	de = (struct xcfs_dir_entry *)(dc->buf + dc->size);
+	de->ino = ino;
+	de->pos = offset;
+	de->namelen = namelen;
+	de->type = d_type;
+	memcpy(de->name, name, namelen);
+	dc->size += reclen;
+	dc->count++;
+	return 0;
+}
+
+/*
+ * Read the whole lower directory into a new cache.  The lower stamp is
+ * sampled before reading, so a change racing with the fill leaves the
+ * cache already stale.  Directories changed within the last second are
+ * not cached: a second change inside the same mtime tick would go
+ * unnoticed.
+ */
+static struct xcfs_dir_cache *xcfs_dircache_fill(struct file *lower_file)
+{
+	struct inode *lower_dir = file_inode(lower_file);
+	struct xcfs_dircache_fill fill = {
+		.ctx.actor = xcfs_dircache_filldir,
+	};
+	struct xcfs_dir_cache *dc;
+	struct timespec now;
+	unsigned int i;
+	size_t off;
+	int err;
+
+	now = current_time(lower_dir);
+	if (now.tv_sec - lower_dir->i_mtime.tv_sec < 1)
+		return ERR_PTR(-EAGAIN);
+
+	dc = kzalloc(sizeof(*dc), GFP_KERNEL);
+	if (!dc)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&dc->ref);
+	INIT_LIST_HEAD(&dc->lru);
+	dc->mtime = lower_dir->i_mtime;
+	dc->version = lower_dir->i_version;
+	smp_rmb();	/* sample the stamp before the entries */
+
+	fill.dc = dc;
+	err = vfs_llseek(lower_file, 0, SEEK_SET);
+	if (err >= 0)
+		err = iterate_dir(lower_file, &fill.ctx);
+	if (fill.err)
+		err = fill.err;
+	if (err < 0)
+		goto out_err;
+	dc->end_pos = lower_file->f_pos;
+
+	dc->offsets = kvmalloc_array(max(dc->count, 1U), sizeof(u32),
+				     GFP_KERNEL);
+	if (!dc->offsets) {
+		err = -ENOMEM;
+		goto out_err;
+	}
+	for (i = 0, off = 0; i < dc->count; i++) {
+		struct xcfs_dir_entry *de =
+			(struct xcfs_dir_entry *)(dc->buf + off);
+
+		dc->offsets[i] = off;
+		off += ALIGN(sizeof(*de) + de->namelen, sizeof(u64));
+	}
+	dc->bytes = sizeof(*dc) + dc->alloc +
+		    max(dc->count, 1U) * sizeof(u32);
+	return dc;
+
+out_err:
+	xcfs_dircache_put(dc);
+	return ERR_PTR(err);
+}
+
+static void xcfs_dircache_install(struct inode *dir,
+				  struct xcfs_dir_cache *dc)
+{
+	struct xcfs_dir_cache *old;
+
+	kref_get(&dc->ref);
+	old = xcfs_dircache_swap(dir, dc);
+	xcfs_dircache_put(old);
+	xcfs_dircache_trim();
+}
+
+static inline struct xcfs_dir_entry *xcfs_dircache_entry(
+	struct xcfs_dir_cache *dc, unsigned int i)
+{
+	return (struct xcfs_dir_entry *)(dc->buf + dc->offsets[i]);
+}
+
+/*
+ * Snapshot index of the entry at lower offset @pos, trying @hint (where
+ * the last listing stopped) first.  Returns count at the end, UINT_MAX
+ * for an offset the snapshot does not have.
+ */
+static unsigned int xcfs_dircache_find(struct xcfs_dir_cache *dc,
+				       unsigned int hint, loff_t pos)
+{
+	unsigned int i;
+
+	if (hint < dc->count && xcfs_dircache_entry(dc, hint)->pos == pos)
+		return hint;
+	if (pos == dc->end_pos)
+		return dc->count;
+	for (i = 0; i < dc->count; i++)
+		if (xcfs_dircache_entry(dc, i)->pos == pos)
+			return i;
+	return UINT_MAX;
+}
+
+/*
+ * Try to serve a listing from the cache.  Each open file lists from the
+ * snapshot it picked up at offset 0, so a listing stays consistent even
+ * if the directory changes halfway through.  Returns -EOPNOTSUPP when
+ * the caller should read the lower directory itself, as for a file that
+ * resumes at an offset without a snapshot, e.g. after a reopen.
+ */
+int xcfs_dircache_iterate(struct file *file, struct dir_context *ctx)
+{
+	struct xcfs_file_info *fi = XCFS_F(file);
+	struct inode *dir = file_inode(file);
+	struct file *lower_file = xcfs_lower_file(file);
+	struct xcfs_dir_cache *dc;
+	unsigned int i;
+
+	if (ctx->pos == 0) {
+		xcfs_dircache_put(fi->dir_cache);
+		fi->dir_cache = NULL;
+		if (!READ_ONCE(xcfs_dircache_enabled))
+			return -EOPNOTSUPP;
+
+		dc = xcfs_dircache_get(dir);
+		if (!dc) {
+			dc = xcfs_dircache_fill(lower_file);
+			if (IS_ERR(dc)) {
+				/* the fill may have moved the lower offset */
+				vfs_llseek(lower_file, 0, SEEK_SET);
+				return -EOPNOTSUPP;
+			}
+			xcfs_dircache_install(dir, dc);
+		}
+		fi->dir_cache = dc;
+		fi->dir_index = 0;
+	}
+
+	dc = fi->dir_cache;
+	if (!dc)
+		return -EOPNOTSUPP;
+	i = ctx->pos ? xcfs_dircache_find(dc, fi->dir_index, ctx->pos) : 0;
+	if (i == UINT_MAX) {
+		/* not an offset we handed out; the lower fs may know it */
+		xcfs_dircache_file_release(file);
+		return -EOPNOTSUPP;
+	}
+	for (; i < dc->count; i++) {
+		struct xcfs_dir_entry *de = xcfs_dircache_entry(dc, i);
+
+		ctx->pos = de->pos;
+		if (!dir_emit(ctx, de->name, de->namelen, de->ino, de->type))
+			break;
+		ctx->pos = i + 1 < dc->count ?
+			xcfs_dircache_entry(dc, i + 1)->pos : dc->end_pos;
+	}
+	if (i == dc->count)
+		ctx->pos = dc->end_pos;
+	fi->dir_index = i;
+	return 0;
+}
+
+/* drop the snapshot an open directory file was listing from */
+void xcfs_dircache_file_release(struct file *file)
+{
+	xcfs_dircache_put(XCFS_F(file)->dir_cache);
+	XCFS_F(file)->dir_cache = NULL;
+}
+
+/* called when the directory inode is evicted */
+void xcfs_dircache_free(struct inode *dir)
+{
+	xcfs_dircache_put(xcfs_dircache_swap(dir, NULL));
+}
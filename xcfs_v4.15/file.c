@@ -10,6 +10,118 @@
  */
 
 #include "xcfs.h"
+#include <linux/compat.h>
+#include "xcfs_trace.h"
+
+/* open @inode's lower file into *@slot once, with the mounter's creds */
+static struct file *xcfs_inode_lower_file(struct inode *inode,
+					  struct file **slot, int flags)
+{
+	struct file *lower_file = READ_ONCE(*slot);
+	struct dentry *dentry;
+	struct path lower_path;
+
+	if (lower_file)
+		return lower_file;
+
+	/* any alias will do, an unlinked one still pins its lower dentry */
+	dentry = d_find_any_alias(inode);
+	if (!dentry)
+		return ERR_PTR(-ESTALE);
+	xcfs_peek_lower_path(dentry, &lower_path);
+	lower_file = dentry_open(&lower_path, flags,
+				 XCFS_SB(inode->i_sb)->cred);
+	dput(dentry);
+	if (IS_ERR(lower_file))
+		return lower_file;
+	/* somebody else got there first */
+	if (cmpxchg(slot, NULL, lower_file)) {
+		fput(lower_file);
+		lower_file = READ_ONCE(*slot);
+	}
+	return lower_file;
+}
+
+/*
+ * Regular files share one read-only lower file per upper inode.  It is
+ * opened on first use and kept until the inode is evicted, so
+ * open/read/close cycles and stat-only opens pay nothing for it, and
+ * readpage has a lower file without needing the caller's struct file.
+ * Being shared, it is opened with the mounter's credentials rather than
+ * those of whichever task happens to touch the inode first.
+ * Only opens for writing (and directories, which need their own f_pos)
+ * still open a private lower file.
+ */
+struct file *xcfs_shared_lower_file(struct inode *inode)
+{
+	return xcfs_inode_lower_file(inode, &XCFS_I(inode)->lower_file,
+				     O_RDONLY | O_LARGEFILE);
+}
+
+/*
+ * The write-only lower file writepage writes through.  Holding lower
+ * write access blocks exec of the lower file and read-only remounts of
+ * the lower fs, so it is only opened once write=back or a shared
+ * writable mapping is about to leave pages dirty; then it stays until
+ * eviction, which writes those pages back.
+ */
+struct file *xcfs_writeback_lower_file(struct inode *inode)
+{
+	return xcfs_inode_lower_file(inode, &XCFS_I(inode)->lower_wfile,
+				     O_WRONLY | O_LARGEFILE);
+}
+
+/*
+ * @file's own lower file, opened with its flags and credentials, for
+ * calls made on behalf of this opener (ioctl, fasync) that must not go
+ * through the shared one.  Read-only opens get theirs on first use and
+ * keep it in their private data until release.
+ */
+struct file *xcfs_private_lower_file(struct file *file)
+{
+	struct xcfs_file_info *info = XCFS_F(file);
+	struct file *lower_file;
+	struct path lower_path;
+
+	if (!info) {
+		info = kzalloc(sizeof(struct xcfs_file_info), GFP_KERNEL);
+		if (!info)
+			return ERR_PTR(-ENOMEM);
+		if (cmpxchg(&file->private_data, NULL, info)) {
+			kfree(info);
+			info = XCFS_F(file);
+		}
+	}
+	lower_file = READ_ONCE(info->lower_file);
+	if (lower_file)
+		return lower_file;
+
+	xcfs_peek_lower_path(file->f_path.dentry, &lower_path);
+	lower_file = dentry_open(&lower_path, file->f_flags, file->f_cred);
+	if (IS_ERR(lower_file))
+		return lower_file;
+	if (cmpxchg(&info->lower_file, NULL, lower_file)) {
+		fput(lower_file);
+		lower_file = READ_ONCE(info->lower_file);
+	}
+	return lower_file;
+}
+
+/* lower file for @file, opening the shared one if needed; ERR_PTR on error */
+struct file *xcfs_get_lower_file(struct file *file)
+{
+	struct file *lower_file = xcfs_lower_file(file);
+
+	if (lower_file)
+		return lower_file;
+	return xcfs_shared_lower_file(file_inode(file));
+}
+
+/* pages may only be left dirty once writepage has a lower file to use */
+bool xcfs_can_write_back(struct inode *inode)
+{
+	return !IS_ERR(xcfs_writeback_lower_file(inode));
+}
 /*read and write are not used, generic_read_iter and write_iter call read_page
  * and writepage*/
 static ssize_t xcfs_read(struct file *file, char __user *buf,
@@ -18,12 +130,14 @@ static ssize_t xcfs_read(struct file *file, char __user *buf,
 	int err;
 	struct file *lower_file;
 	struct dentry *dentry = file->f_path.dentry;
-	lower_file = xcfs_lower_file(file);
+	lower_file = xcfs_get_lower_file(file);
+	if (IS_ERR(lower_file))
+		return PTR_ERR(lower_file);
+	xcfs_inject(dentry->d_sb, XCFS_INJ_READ, count);
 	err = vfs_read(lower_file, buf, count, ppos);
 	/* update our inode atime upon a successful lower read */
 	if (err >= 0)
-		fsstack_copy_attr_atime(d_inode(dentry),
-					file_inode(lower_file));
+		xcfs_mark_attr_stale(d_inode(dentry), XCFS_STALE_ATIME);
 	return err;
 }
 
@@ -35,29 +149,56 @@ static ssize_t xcfs_write(struct file *file, const char __user *buf,
 	struct dentry *dentry = file->f_path.dentry;
 
 	lower_file = xcfs_lower_file(file);
+	xcfs_inject(dentry->d_sb, XCFS_INJ_WRITE, count);
 	err = vfs_write(lower_file, buf, count, ppos);
 	/* update our inode times+sizes upon a successful lower write */
-	if (err >= 0) {
-		fsstack_copy_inode_size(d_inode(dentry),
-					file_inode(lower_file));
-		fsstack_copy_attr_times(d_inode(dentry),
-					file_inode(lower_file));
-	}
+	if (err >= 0)
+		xcfs_mark_attr_stale(d_inode(dentry),
+				     XCFS_STALE_SIZE | XCFS_STALE_TIMES);
 	return err;
 }
 
-static int xcfs_readdir(struct file *file, struct dir_context *ctx)
+static int __xcfs_readdir(struct file *file, struct dir_context *ctx)
 {
 	int err;
 	struct file *lower_file = NULL;
 	struct dentry *dentry = file->f_path.dentry;
 
+	err = xcfs_dircache_iterate(file, ctx);
+	if (err != -EOPNOTSUPP)
+		goto out;
+
 	lower_file = xcfs_lower_file(file);
+	/* listing from the cache leaves the lower offset behind */
+	if (lower_file->f_pos != ctx->pos) {
+		loff_t pos = vfs_llseek(lower_file, ctx->pos, SEEK_SET);
+
+		if (pos < 0) {
+			err = pos;
+			goto out;
+		}
+	}
 	err = iterate_dir(lower_file, ctx);
 	file->f_pos = lower_file->f_pos;
-	if (err >= 0)		/* copy the atime */
-		fsstack_copy_attr_atime(d_inode(dentry),
-					file_inode(lower_file));
+out:
+	if (err >= 0)		/* copy the atime later */
+		xcfs_mark_attr_stale(d_inode(dentry), XCFS_STALE_ATIME);
+	return err;
+}
+
+/*
+ * Runs as ->iterate_shared: the VFS holds our directory's i_rwsem shared,
+ * and each open file has its own lower file, so concurrent listings of
+ * one directory proceed in parallel.
+ */
+static int xcfs_readdir(struct file *file, struct dir_context *ctx)
+{
+	loff_t pos = ctx->pos;
+	int err;
+
+	err = xcfs_prefetch_readdir(file, ctx, __xcfs_readdir);
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_READDIR);
+	trace_xcfs_readdir(file_inode(file), pos, ctx->pos - pos, err);
 	return err;
 }
 
@@ -66,10 +207,15 @@ static long xcfs_unlocked_ioctl(struct file *file, unsigned int cmd,
 {
 	long err = -ENOTTY;
 	struct file *lower_file;
-	lower_file = xcfs_lower_file(file);
+
+	err = xcfs_ioctl(file, cmd, (void __user *)arg);
+	if (err != -ENOIOCTLCMD)
+		goto out;
+	err = -ENOTTY;
+	lower_file = xcfs_private_lower_file(file);
 
 	/* XXX: use vfs_ioctl if/when VFS exports it */
-	if (!lower_file || !lower_file->f_op)
+	if (IS_ERR(lower_file) || !lower_file->f_op)
 		goto out;
 	if (lower_file->f_op->unlocked_ioctl)
 		err = lower_file->f_op->unlocked_ioctl(lower_file, cmd, arg);
@@ -79,6 +225,8 @@ static long xcfs_unlocked_ioctl(struct file *file, unsigned int cmd,
 		fsstack_copy_attr_all(file_inode(file),
 				      file_inode(lower_file));
 out:
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_IOCTL);
+	trace_xcfs_ioctl(file_inode(file), cmd, err);
 	return err;
 }
 
@@ -89,15 +237,22 @@ static long xcfs_compat_ioctl(struct file *file, unsigned int cmd,
 	long err = -ENOTTY;
 	struct file *lower_file;
 
-	lower_file = xcfs_lower_file(file);
+	/* our own ioctl structures have the same layout under compat */
+	err = xcfs_ioctl(file, cmd, compat_ptr(arg));
+	if (err != -ENOIOCTLCMD)
+		goto out;
+	err = -ENOTTY;
+	lower_file = xcfs_private_lower_file(file);
 
 	/* XXX: use vfs_ioctl if/when VFS exports it */
-	if (!lower_file || !lower_file->f_op)
+	if (IS_ERR(lower_file) || !lower_file->f_op)
 		goto out;
 	if (lower_file->f_op->compat_ioctl)
 		err = lower_file->f_op->compat_ioctl(lower_file, cmd, arg);
 
 out:
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_IOCTL);
+	trace_xcfs_ioctl(file_inode(file), cmd, err);
 	return err;
 }
 #endif
@@ -105,12 +260,28 @@ out:
 static int xcfs_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct file *lower_file;
+	int err;
 
-	lower_file = xcfs_lower_file(file);
+	lower_file = xcfs_get_lower_file(file);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
 	if(!lower_file->f_op->mmap) {
-		return -ENODEV;
+		err = -ENODEV;
+		goto out;
 	}
-	return generic_file_mmap(file, vma);
+	/* dirty pages of a shared mapping reach the lower file via writepage */
+	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE) &&
+	    !xcfs_can_write_back(file_inode(file))) {
+		err = -EACCES;
+		goto out;
+	}
+	err = generic_file_mmap(file, vma);
+out:
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_MMAP);
+	trace_xcfs_mmap(file_inode(file), file, err);
+	return err;
 }
 
 static int xcfs_open(struct inode *inode, struct file *file)
@@ -118,12 +289,25 @@ static int xcfs_open(struct inode *inode, struct file *file)
 	int err = 0;
 	struct file *lower_file = NULL;
 	struct path lower_path;
+	struct xcfs_op_timer timer;
+
+	xcfs_timer_start(inode->i_sb, &timer, inode->i_ino, 0, 0);
 	/* don't open unhashed/deleted files */
 	if (d_unhashed(file->f_path.dentry)) {
 		err = -ENOENT;
 		goto out_err;
 	}
 
+	/*
+	 * Read-only opens of regular files need no private data until an
+	 * ioctl or fasync wants their own lower file: they use the inode's
+	 * shared lower file, opened lazily.
+	 */
+	if (S_ISREG(inode->i_mode) && !(file->f_mode & FMODE_WRITE)) {
+		file->private_data = NULL;
+		goto out_attr;
+	}
+
 	file->private_data =
 		kzalloc(sizeof(struct xcfs_file_info), GFP_KERNEL);
 	if (!XCFS_F(file)) {
@@ -132,9 +316,8 @@ static int xcfs_open(struct inode *inode, struct file *file)
 	}
 
 	/* open lower object and link xcfs's file struct to lower's */
-	xcfs_get_lower_path(file->f_path.dentry, &lower_path);
+	xcfs_peek_lower_path(file->f_path.dentry, &lower_path);
 	lower_file = dentry_open(&lower_path, file->f_flags, current_cred());
-	path_put(&lower_path);
 	if (IS_ERR(lower_file)) {
 		err = PTR_ERR(lower_file);
 		lower_file = xcfs_lower_file(file);
@@ -146,11 +329,16 @@ static int xcfs_open(struct inode *inode, struct file *file)
 		xcfs_set_lower_file(file, lower_file);
 	}
 
-	if (err)
+	if (err) {
 		kfree(XCFS_F(file));
-	else
-		fsstack_copy_attr_all(inode, xcfs_lower_inode(inode));
+		goto out_err;
+	}
+out_attr:
+	xcfs_sync_attr(inode, STATX_BASIC_STATS);
 out_err:
+	xcfs_timer_end(inode->i_sb, &timer, XCFS_LAT_OPEN);
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_OPEN);
+	trace_xcfs_open(inode, file, err);
 	return err;
 }
 
@@ -159,19 +347,32 @@ static int xcfs_flush(struct file *file, fl_owner_t id)
 	int err = 0;
 	struct file *lower_file = NULL;
   
-	lower_file = xcfs_lower_file(file);
+	/* only flush a lower file this open owns, never the shared one */
+	if (XCFS_F(file))
+		lower_file = XCFS_F(file)->lower_file;
 	if (lower_file && lower_file->f_op && lower_file->f_op->flush) {
 		filemap_write_and_wait(file->f_mapping);
 		err = lower_file->f_op->flush(lower_file, id);
 	}
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_FLUSH);
+	trace_xcfs_flush(file_inode(file), file, err);
 	return err;
 }
 
-/* release all lower object references & free the file info structure */
+/*
+ * release all lower object references & free the file info structure;
+ * the inode's shared lower file stays open until eviction
+ */
 static int xcfs_file_release(struct inode *inode, struct file *file)
 {
 	struct file *lower_file;
-	lower_file = xcfs_lower_file(file);
+
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_RELEASE);
+	trace_xcfs_release(inode, file, 0);
+	if (!XCFS_F(file))
+		return 0;
+	xcfs_dircache_file_release(file);
+	lower_file = XCFS_F(file)->lower_file;
 	if (lower_file) {
 		xcfs_set_lower_file(file, NULL);
 		fput(lower_file);
@@ -187,17 +388,32 @@ static int xcfs_fsync(struct file *file, loff_t start, loff_t end,
 {
 	int err;
 	struct file *lower_file;
-	struct path lower_path;
-	struct dentry *dentry = file->f_path.dentry;
+	struct xcfs_op_timer timer;
 
+	xcfs_timer_start(file_inode(file)->i_sb, &timer,
+			 file_inode(file)->i_ino, start,
+			 (size_t)(end - start) + 1);
 	err = __generic_file_fsync(file, start, end, datasync);
 	if (err)
 		goto out;
-	lower_file = xcfs_lower_file(file);
-	xcfs_get_lower_path(dentry, &lower_path);
+	lower_file = xcfs_get_lower_file(file);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
 	err = vfs_fsync_range(lower_file, start, end, datasync);
-	xcfs_put_lower_path(dentry, &lower_path);
+	if (err)
+		goto out;
+	xcfs_sync_stale_attr(file_inode(file));
+	/* cache=plain: the synced ciphertext is clean and can go */
+	if (xcfs_cache_mode(file_inode(file)->i_sb) == XCFS_CACHE_PLAIN)
+		invalidate_mapping_pages(lower_file->f_mapping,
+					 start >> PAGE_SHIFT, end >> PAGE_SHIFT);
 out:
+	xcfs_timer_end(file_inode(file)->i_sb, &timer, XCFS_LAT_FSYNC);
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_FSYNC);
+	trace_xcfs_fsync(file_inode(file), start, (size_t)(end - start) + 1,
+			 err);
 	return err;
 }
 
@@ -206,7 +422,14 @@ static int xcfs_fasync(int fd, struct file *file, int flag)
 {
 	int err = 0;
 	struct file *lower_file = NULL;
-	lower_file = xcfs_lower_file(file);
+
+	xcfs_stat_inc(file_inode(file)->i_sb, XCFS_STAT_FASYNC);
+	/* nothing was registered below if we never opened our own */
+	if (!flag && !(XCFS_F(file) && XCFS_F(file)->lower_file))
+		return 0;
+	lower_file = xcfs_private_lower_file(file);
+	if (IS_ERR(lower_file))
+		return PTR_ERR(lower_file);
 	if (lower_file->f_op && lower_file->f_op->fasync)
 		err = lower_file->f_op->fasync(fd, lower_file, flag);
 	return err;
@@ -241,7 +464,11 @@ xcfs_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
 	int err;
 	struct file *file = iocb->ki_filp, *lower_file;
-	lower_file = xcfs_lower_file(file);
+	lower_file = xcfs_get_lower_file(file);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
 	if (!lower_file->f_op->read_iter) {
 		err = -EINVAL;
 		goto out;
@@ -254,8 +481,8 @@ xcfs_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 	fput(lower_file);
 	/* update upper inode atime as needed */
 	if (err >= 0 || err == -EIOCBQUEUED)
-		fsstack_copy_attr_atime(d_inode(file->f_path.dentry),
-					file_inode(lower_file));
+		xcfs_mark_attr_stale(d_inode(file->f_path.dentry),
+				     XCFS_STALE_ATIME);
 out:
 	return err;
 }
@@ -280,16 +507,96 @@ xcfs_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	iocb->ki_filp = file;
 	fput(lower_file);
 	/* update upper inode times/sizes as needed */
-	if (err >= 0 || err == -EIOCBQUEUED) {
-		fsstack_copy_inode_size(d_inode(file->f_path.dentry),
-					file_inode(lower_file));
-		fsstack_copy_attr_times(d_inode(file->f_path.dentry),
-					file_inode(lower_file));
-	}
+	if (err >= 0 || err == -EIOCBQUEUED)
+		xcfs_mark_attr_stale(d_inode(file->f_path.dentry),
+				     XCFS_STALE_SIZE | XCFS_STALE_TIMES);
 out:
 	return err;
 }
 
+/*
+ * cache=cipher: drop the plaintext of [pos, pos + len) once the caller is
+ * done with it.  Dirty, mapped and locked pages stay.
+ */
+static void xcfs_cache_drop_plain(struct file *file, loff_t pos, ssize_t len)
+{
+	if (len <= 0 ||
+	    xcfs_cache_mode(file_inode(file)->i_sb) != XCFS_CACHE_CIPHER)
+		return;
+	invalidate_mapping_pages(file->f_mapping, pos >> PAGE_SHIFT,
+				 (pos + len - 1) >> PAGE_SHIFT);
+}
+
+/* page cache read/write for xcfs_mmap_fops, wrapped for tracing and stats */
+/*
+ * With stats on, count the pages a read is about to cover that are
+ * already cached and uptodate (hits) or that readpage will have to fill
+ * (misses).  Lockless page cache lookups, done before the read.
+ */
+static void xcfs_count_cache_hits(struct file *file, loff_t pos, size_t len)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	loff_t size = i_size_read(file_inode(file));
+	pgoff_t index, last;
+	struct page *page;
+	u64 hits = 0, misses = 0;
+
+	if (!xcfs_stats_on(sb) || !len || pos >= size)
+		return;
+	if (len > size - pos)
+		len = size - pos;
+	last = (pos + len - 1) >> PAGE_SHIFT;
+	for (index = pos >> PAGE_SHIFT; index <= last; index++) {
+		page = find_get_page(file->f_mapping, index);
+		if (page && PageUptodate(page))
+			hits++;
+		else
+			misses++;
+		if (page)
+			put_page(page);
+	}
+	xcfs_stat_add(sb, XCFS_STAT_PAGE_CACHE_HITS, hits);
+	xcfs_stat_add(sb, XCFS_STAT_PAGE_CACHE_MISSES, misses);
+}
+
+static ssize_t xcfs_cache_read_iter(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct super_block *sb = file_inode(iocb->ki_filp)->i_sb;
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(iter);
+	ssize_t ret;
+
+	xcfs_count_cache_hits(iocb->ki_filp, pos, len);
+	ret = generic_file_read_iter(iocb, iter);
+	xcfs_cache_drop_plain(iocb->ki_filp, pos, ret);
+	xcfs_stat_inc(sb, XCFS_STAT_READ_ITER);
+	if (ret > 0) {
+		xcfs_stat_add(sb, XCFS_STAT_READ_BYTES, ret);
+		xcfs_stat_add(sb, XCFS_STAT_READ_PAGES,
+			      ((pos + ret - 1) >> PAGE_SHIFT) -
+			      (pos >> PAGE_SHIFT) + 1);
+	}
+	trace_xcfs_read_iter(file_inode(iocb->ki_filp), pos, len, ret);
+	return ret;
+}
+
+static ssize_t xcfs_cache_write_iter(struct kiocb *iocb,
+				     struct iov_iter *iter)
+{
+	struct super_block *sb = file_inode(iocb->ki_filp)->i_sb;
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(iter);
+	ssize_t ret;
+
+	ret = generic_file_write_iter(iocb, iter);
+	xcfs_cache_drop_plain(iocb->ki_filp, pos, ret);
+	xcfs_stat_inc(sb, XCFS_STAT_WRITE_ITER);
+	if (ret > 0)
+		xcfs_stat_add(sb, XCFS_STAT_WRITE_BYTES, ret);
+	trace_xcfs_write_iter(file_inode(iocb->ki_filp), pos, len, ret);
+	return ret;
+}
+
 //we are not using this fops
 const struct file_operations xcfs_main_fops = {
 	.llseek		= generic_file_llseek,
@@ -312,8 +619,8 @@ const struct file_operations xcfs_main_fops = {
 // NEW fops added
 const struct file_operations xcfs_mmap_fops = {
 	.llseek		= generic_file_llseek,
-	.read_iter	= generic_file_read_iter,
-	.write_iter	= generic_file_write_iter,
+	.read_iter	= xcfs_cache_read_iter,
+	.write_iter	= xcfs_cache_write_iter,
 	.unlocked_ioctl	= xcfs_unlocked_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= xcfs_compat_ioctl,
@@ -330,7 +637,7 @@ const struct file_operations xcfs_mmap_fops = {
 const struct file_operations xcfs_dir_fops = {
 	.llseek		= xcfs_file_llseek,
 	.read		= generic_read_dir,
-	.iterate	= xcfs_readdir,
+	.iterate_shared	= xcfs_readdir,
 	.unlocked_ioctl	= xcfs_unlocked_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= xcfs_compat_ioctl,
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+
+/*
+ * Slow lower storage on demand, for benchmarking.  Each kind of lower
+ * call (see XCFS_INJECTS) can be given a fixed latency, a uniformly
+ * distributed jitter on top, and a bandwidth cap.  The cap models one
+ * link per kind shared by the whole mount: transfers queue behind each
+ * other and each takes bytes / bandwidth.  Everything is off (0) by
+ * default and is set per mount under
+ * <debugfs>/xcfs/<major>:<minor>/inject/<kind>/.  Time spent sleeping
+ * is counted in the injected_ns statistic.
+ */
+
+static const char * const xcfs_inject_names[XCFS_INJ_NR] = {
+#define XCFS_INJ_NAME(id, name)	[XCFS_INJ_##id] = name,
+	XCFS_INJECTS(XCFS_INJ_NAME)
+#undef XCFS_INJ_NAME
+};
+
+static void xcfs_inject_sleep(u64 ns)
+{
+	unsigned long us = max_t(unsigned long, div_u64(ns, NSEC_PER_USEC), 1);
+
+	/* usleep_range() is for short waits; msleep() is fine for long ones */
+	if (us >= 20 * USEC_PER_MSEC)
+		msleep(us / USEC_PER_MSEC);
+	else
+		usleep_range(us, us + us / 8 + 1);
+}
+
+/* called through xcfs_inject() when any knob of @op is set */
+void __xcfs_inject(struct super_block *sb, enum xcfs_inj op, size_t bytes)
+{
+	struct xcfs_inject *inj = &XCFS_SB(sb)->inject;
+	u32 jitter = READ_ONCE(inj->jitter_us[op]);
+	u32 bw = READ_ONCE(inj->bw_kbps[op]);
+	u64 delay = (u64)READ_ONCE(inj->latency_us[op]) * NSEC_PER_USEC;
+	u64 now, start, xfer;
+
+	if (jitter)
+		delay += (u64)prandom_u32_max(jitter + 1) * NSEC_PER_USEC;
+	if (bw && bytes) {
+		xfer = div64_u64((u64)bytes * NSEC_PER_SEC, (u64)bw << 10);
+		now = ktime_get_ns();
+		spin_lock(&inj->lock);
+		start = max(now, inj->busy_until[op]);
+		inj->busy_until[op] = start + xfer;
+		spin_unlock(&inj->lock);
+		delay += start + xfer - now;
+	}
+	if (!delay)
+		return;
+	xcfs_stat_add(sb, XCFS_STAT_INJECTED_NS, delay);
+	xcfs_inject_sleep(delay);
+}
+
+void xcfs_inject_init_sb(struct super_block *sb)
+{
+	struct xcfs_inject *inj = &XCFS_SB(sb)->inject;
+	struct dentry *dir, *sub;
+	int op;
+
+	spin_lock_init(&inj->lock);
+	if (IS_ERR_OR_NULL(XCFS_SB(sb)->debugfs_dir))
+		return;
+	dir = debugfs_create_dir("inject", XCFS_SB(sb)->debugfs_dir);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+	for (op = 0; op < XCFS_INJ_NR; op++) {
+		sub = debugfs_create_dir(xcfs_inject_names[op], dir);
+		if (IS_ERR_OR_NULL(sub))
+			continue;
+		debugfs_create_u32("latency_us", 0644, sub,
+				   &inj->latency_us[op]);
+		debugfs_create_u32("jitter_us", 0644, sub,
+				   &inj->jitter_us[op]);
+		debugfs_create_u32("bw_kbps", 0644, sub, &inj->bw_kbps[op]);
+	}
+}
@@ -10,6 +10,82 @@
  */
 
 #include "xcfs.h"
+#include "xcfs_trace.h"
+
+static inline void xcfs_copy_time(struct timespec *dst,
+				  const struct timespec *src)
+{
+	if (!timespec_equal(dst, src))
+		*dst = *src;
+}
+
+static inline void xcfs_test_clear_stale(struct inode *inode, int bits)
+{
+	atomic_t *stale = &XCFS_I(inode)->attr_stale;
+
+	if (atomic_read(stale) & bits)
+		atomic_andnot(bits, stale);
+}
+
+/* fields xcfs_sync_attr() only copies up when @mask names them */
+#define XCFS_SYNC_ATTR_MASK	(STATX_MODE | STATX_NLINK | STATX_UID | \
+				 STATX_GID | STATX_ATIME | STATX_MTIME | \
+				 STATX_CTIME | STATX_SIZE)
+
+/*
+ * Copy the attributes named in @mask (STATX_*) up from the lower inode.
+ * Fields are only written when they differ, so repeated calls on a busy
+ * file leave the upper inode's cachelines shared between CPUs.  Atime is
+ * never pulled up on noatime inodes.
+ */
+void xcfs_sync_attr(struct inode *inode, u32 mask)
+{
+	struct inode *lower_inode = xcfs_lower_inode(inode);
+
+	if (mask & STATX_ATIME) {
+		xcfs_test_clear_stale(inode, XCFS_STALE_ATIME);
+		if (!IS_NOATIME(inode))
+			xcfs_copy_time(&inode->i_atime, &lower_inode->i_atime);
+	}
+	if (mask & (STATX_MTIME | STATX_CTIME)) {
+		xcfs_test_clear_stale(inode, XCFS_STALE_TIMES);
+		xcfs_copy_time(&inode->i_mtime, &lower_inode->i_mtime);
+		xcfs_copy_time(&inode->i_ctime, &lower_inode->i_ctime);
+	}
+	if (mask & STATX_SIZE) {
+		xcfs_test_clear_stale(inode, XCFS_STALE_SIZE);
+		if (i_size_read(inode) != i_size_read(lower_inode))
+			fsstack_copy_inode_size(inode, lower_inode);
+	}
+	if ((mask & (STATX_TYPE | STATX_MODE)) &&
+	    inode->i_mode != lower_inode->i_mode)
+		inode->i_mode = lower_inode->i_mode;
+	if ((mask & STATX_UID) && !uid_eq(inode->i_uid, lower_inode->i_uid))
+		inode->i_uid = lower_inode->i_uid;
+	if ((mask & STATX_GID) && !gid_eq(inode->i_gid, lower_inode->i_gid))
+		inode->i_gid = lower_inode->i_gid;
+	if ((mask & STATX_NLINK) && inode->i_nlink != lower_inode->i_nlink)
+		set_nlink(inode, lower_inode->i_nlink);
+	if (inode->i_flags != lower_inode->i_flags)
+		inode->i_flags = lower_inode->i_flags;
+}
+
+/* only copy what hot paths have marked stale */
+void xcfs_sync_stale_attr(struct inode *inode)
+{
+	int stale = atomic_read(&XCFS_I(inode)->attr_stale);
+	u32 mask = 0;
+
+	if (!stale)
+		return;
+	if (stale & XCFS_STALE_ATIME)
+		mask |= STATX_ATIME;
+	if (stale & XCFS_STALE_TIMES)
+		mask |= STATX_MTIME | STATX_CTIME;
+	if (stale & XCFS_STALE_SIZE)
+		mask |= STATX_SIZE;
+	xcfs_sync_attr(inode, mask);
+}
 
 static int xcfs_create(struct inode *dir, struct dentry *dentry,
 			 umode_t mode, bool want_excl)
@@ -18,8 +94,7 @@ static int xcfs_create(struct inode *dir, struct dentry *dentry,
 	struct dentry *lower_dentry;
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
-  printk(KERN_INFO "xcfs_create");
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
 
@@ -30,12 +105,14 @@ static int xcfs_create(struct inode *dir, struct dentry *dentry,
 	err = xcfs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, xcfs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_CREATE);
+	trace_xcfs_create(dir, dentry, err);
 	return err;
 }
 
@@ -49,10 +126,9 @@ static int xcfs_link(struct dentry *old_dentry, struct inode *dir,
 	int err;
 	struct path lower_old_path, lower_new_path;
 
-  printk(KERN_INFO "xcfs_link");
 	file_size_save = i_size_read(d_inode(old_dentry));
-	xcfs_get_lower_path(old_dentry, &lower_old_path);
-	xcfs_get_lower_path(new_dentry, &lower_new_path);
+	xcfs_peek_lower_path(old_dentry, &lower_old_path);
+	xcfs_peek_lower_path(new_dentry, &lower_new_path);
 	lower_old_dentry = lower_old_path.dentry;
 	lower_new_dentry = lower_new_path.dentry;
 	lower_dir_dentry = lock_parent(lower_new_dentry);
@@ -65,6 +141,7 @@ static int xcfs_link(struct dentry *old_dentry, struct inode *dir,
 	err = xcfs_interpose(new_dentry, dir->i_sb, &lower_new_path);
 	if (err)
 		goto out;
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, d_inode(lower_new_dentry));
 	fsstack_copy_inode_size(dir, d_inode(lower_new_dentry));
 	set_nlink(d_inode(old_dentry),
@@ -72,8 +149,8 @@ static int xcfs_link(struct dentry *old_dentry, struct inode *dir,
 	i_size_write(d_inode(new_dentry), file_size_save);
 out:
 	unlock_dir(lower_dir_dentry);
-	xcfs_put_lower_path(old_dentry, &lower_old_path);
-	xcfs_put_lower_path(new_dentry, &lower_new_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_LINK);
+	trace_xcfs_link(dir, new_dentry, err);
 	return err;
 }
 
@@ -84,8 +161,7 @@ static int xcfs_unlink(struct inode *dir, struct dentry *dentry)
 	struct inode *lower_dir_inode = xcfs_lower_inode(dir);
 	struct dentry *lower_dir_dentry;
 	struct path lower_path;
-  printk(KERN_INFO "xcfs_unlink");
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	dget(lower_dentry);
 	lower_dir_dentry = lock_parent(lower_dentry);
@@ -103,6 +179,7 @@ static int xcfs_unlink(struct inode *dir, struct dentry *dentry)
 		err = 0;
 	if (err)
 		goto out;
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, lower_dir_inode);
 	fsstack_copy_inode_size(dir, lower_dir_inode);
 	set_nlink(d_inode(dentry),
@@ -112,7 +189,8 @@ static int xcfs_unlink(struct inode *dir, struct dentry *dentry)
 out:
 	unlock_dir(lower_dir_dentry);
 	dput(lower_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_UNLINK);
+	trace_xcfs_unlink(dir, dentry, err);
 	return err;
 }
 
@@ -124,7 +202,7 @@ static int xcfs_symlink(struct inode *dir, struct dentry *dentry,
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
 
@@ -134,12 +212,14 @@ static int xcfs_symlink(struct inode *dir, struct dentry *dentry,
 	err = xcfs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, xcfs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_SYMLINK);
+	trace_xcfs_symlink(dir, dentry, err);
 	return err;
 }
 
@@ -150,7 +230,7 @@ static int xcfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
 
@@ -162,6 +242,7 @@ static int xcfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 	if (err)
 		goto out;
 
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, xcfs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 	/* update number of links on parent directory */
@@ -169,7 +250,8 @@ static int xcfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 
 out:
 	unlock_dir(lower_parent_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_MKDIR);
+	trace_xcfs_mkdir(dir, dentry, err);
 	return err;
 }
 
@@ -180,7 +262,7 @@ static int xcfs_rmdir(struct inode *dir, struct dentry *dentry)
 	int err;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_dir_dentry = lock_parent(lower_dentry);
 
@@ -191,13 +273,15 @@ static int xcfs_rmdir(struct inode *dir, struct dentry *dentry)
 	d_drop(dentry);	/* drop our dentry on success (why not VFS's job?) */
 	if (d_inode(dentry))
 		clear_nlink(d_inode(dentry));
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, d_inode(lower_dir_dentry));
 	fsstack_copy_inode_size(dir, d_inode(lower_dir_dentry));
 	set_nlink(dir, d_inode(lower_dir_dentry)->i_nlink);
 
 out:
 	unlock_dir(lower_dir_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_RMDIR);
+	trace_xcfs_rmdir(dir, dentry, err);
 	return err;
 }
 
@@ -209,7 +293,7 @@ static int xcfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode,
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
 
@@ -220,12 +304,14 @@ static int xcfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode,
 	err = xcfs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	xcfs_dircache_invalidate(dir);
 	fsstack_copy_attr_times(dir, xcfs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_MKNOD);
+	trace_xcfs_mknod(dir, dentry, err);
 	return err;
 }
 
@@ -248,8 +334,8 @@ static int xcfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (flags)
 		return -EINVAL;
 
-	xcfs_get_lower_path(old_dentry, &lower_old_path);
-	xcfs_get_lower_path(new_dentry, &lower_new_path);
+	xcfs_peek_lower_path(old_dentry, &lower_old_path);
+	xcfs_peek_lower_path(new_dentry, &lower_new_path);
 	lower_old_dentry = lower_old_path.dentry;
 	lower_new_dentry = lower_new_path.dentry;
 	lower_old_dir_dentry = dget_parent(lower_old_dentry);
@@ -273,6 +359,8 @@ static int xcfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (err)
 		goto out;
 
+	xcfs_dircache_invalidate(new_dir);
+	xcfs_dircache_invalidate(old_dir);
 	fsstack_copy_attr_all(new_dir, d_inode(lower_new_dir_dentry));
 	fsstack_copy_inode_size(new_dir, d_inode(lower_new_dir_dentry));
 	if (new_dir != old_dir) {
@@ -286,75 +374,87 @@ out:
 	unlock_rename(lower_old_dir_dentry, lower_new_dir_dentry);
 	dput(lower_old_dir_dentry);
 	dput(lower_new_dir_dentry);
-	xcfs_put_lower_path(old_dentry, &lower_old_path);
-	xcfs_put_lower_path(new_dentry, &lower_new_path);
+	xcfs_stat_inc(old_dir->i_sb, XCFS_STAT_RENAME);
+	trace_xcfs_rename(old_dir, old_dentry, new_dir, new_dentry, err);
 	return err;
 }
 
-static int xcfs_readlink(struct dentry *dentry, char __user *buf, int bufsiz)
+/* read the lower link body into the kernel buffer @buf */
+static int xcfs_read_lower_link(struct dentry *dentry, char *buf, int bufsiz)
 {
 	int err;
-	struct dentry *lower_dentry;
 	struct path lower_path;
+	mm_segment_t old_fs;
 
-	xcfs_get_lower_path(dentry, &lower_path);
-	lower_dentry = lower_path.dentry;
-	if (!d_inode(lower_dentry)->i_op ||
-	    !d_inode(lower_dentry)->i_op->readlink) {
-		err = -EINVAL;
-		goto out;
-	}
-
-	err = d_inode(lower_dentry)->i_op->readlink(lower_dentry,
-						    buf, bufsiz);
-	if (err < 0)
-		goto out;
-	fsstack_copy_attr_atime(d_inode(dentry), d_inode(lower_dentry));
-
-out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	err = vfs_readlink(lower_path.dentry, (char __user *)buf, bufsiz);
+	set_fs(old_fs);
 	return err;
 }
 
+/*
+ * The link body is read once and cached in i_link, after which the VFS
+ * follows the link (in RCU-walk too) and serves readlink(2) without
+ * calling us.  A lower symlink's target cannot change in place: a new
+ * target means a new lower inode, which xcfs_d_revalidate catches, and
+ * then a new upper inode.  It is freed with the inode.
+ */
 static const char *xcfs_get_link(struct dentry *dentry, struct inode *inode,
 				   struct delayed_call *done)
 {
-	char *buf;
-	int len = PAGE_SIZE, err;
-	mm_segment_t old_fs;
+	char *buf, *link;
+	int err;
 
+	link = READ_ONCE(inode->i_link);
+	if (link) {
+		trace_xcfs_get_link(inode, true, 0);
+		return link;
+	}
 	if (!dentry)
 		return ERR_PTR(-ECHILD);
 
-	/* This is freed by the put_link method assuming a successful call. */
-	buf = kmalloc(len, GFP_KERNEL);
+	buf = kmalloc(PATH_MAX, GFP_KERNEL);
 	if (!buf) {
-		buf = ERR_PTR(-ENOMEM);
-		return buf;
+		err = -ENOMEM;
+		goto out_err;
 	}
-
-	/* read the symlink, and then we will follow it */
-	old_fs = get_fs();
-	set_fs(KERNEL_DS);
-	err = xcfs_readlink(dentry, buf, len);
-	set_fs(old_fs);
+	err = xcfs_read_lower_link(dentry, buf, PATH_MAX - 1);
 	if (err < 0) {
 		kfree(buf);
-		buf = ERR_PTR(err);
-	} else {
-		buf[err] = '\0';
+		goto out_err;
+	}
+	buf[err] = '\0';
+	link = kmemdup(buf, err + 1, GFP_KERNEL);
+	kfree(buf);
+	if (!link) {
+		err = -ENOMEM;
+		goto out_err;
 	}
-	set_delayed_call(done, kfree_link, buf);
-	return buf;
+
+	if (cmpxchg(&inode->i_link, NULL, link)) {
+		kfree(link);
+		link = READ_ONCE(inode->i_link);
+	}
+	xcfs_mark_attr_stale(inode, XCFS_STALE_ATIME);
+	trace_xcfs_get_link(inode, false, 0);
+	return link;
+
+out_err:
+	trace_xcfs_get_link(inode, false, err);
+	return ERR_PTR(err);
 }
 
 static int xcfs_permission(struct inode *inode, int mask)
 {
 	struct inode *lower_inode;
 	int err;
-  printk(KERN_INFO "xcfs_permission");
+
 	lower_inode = xcfs_lower_inode(inode);
 	err = inode_permission(lower_inode, mask);
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_PERMISSION);
+	trace_xcfs_permission(inode, mask, err);
 	return err;
 }
 
@@ -378,14 +478,17 @@ static int xcfs_setattr(struct dentry *dentry, struct iattr *ia)
 	if (err)
 		goto out_err;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_inode = xcfs_lower_inode(inode);
 
 	/* prepare our own lower struct iattr (with the lower file) */
 	memcpy(&lower_ia, ia, sizeof(lower_ia));
-	if (ia->ia_valid & ATTR_FILE)
+	if (ia->ia_valid & ATTR_FILE) {
 		lower_ia.ia_file = xcfs_lower_file(ia->ia_file);
+		if (!lower_ia.ia_file)
+			lower_ia.ia_valid &= ~ATTR_FILE;
+	}
 
 	/*
 	 * If shrinking, first truncate upper level to cancel writing dirty
@@ -398,7 +501,7 @@ static int xcfs_setattr(struct dentry *dentry, struct iattr *ia)
 	if (ia->ia_valid & ATTR_SIZE) {
 		err = inode_newsize_ok(inode, ia->ia_size);
 		if (err)
-			goto out;
+			goto out_err;
 		truncate_setsize(inode, ia->ia_size);
 	}
 
@@ -420,7 +523,7 @@ static int xcfs_setattr(struct dentry *dentry, struct iattr *ia)
 			    NULL);
 	inode_unlock(d_inode(lower_dentry));
 	if (err)
-		goto out;
+		goto out_err;
 
 	/* get attributes from the lower inode */
 	fsstack_copy_attr_all(inode, lower_inode);
@@ -430,9 +533,9 @@ static int xcfs_setattr(struct dentry *dentry, struct iattr *ia)
 	 * lower_inode should update its size.
 	 */
 
-out:
-	xcfs_put_lower_path(dentry, &lower_path);
 out_err:
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_SETATTR);
+	trace_xcfs_setattr(inode, ia, err);
 	return err;
 }
 
@@ -442,16 +545,23 @@ static int xcfs_getattr(const struct path *path, struct kstat *stat,
 	struct kstat lower_stat;
 	struct path lower_path;
 
-	xcfs_get_lower_path(path->dentry, &lower_path);
+	xcfs_peek_lower_path(path->dentry, &lower_path);
 	err = vfs_getattr(&lower_path, &lower_stat, request_mask, flags);
 	if (err)
 		goto out;
-	fsstack_copy_attr_all(d_inode(path->dentry),
-			      d_inode(lower_path.dentry));
+	/* only pull up what the caller asked for */
+	if (path->mnt->mnt_flags & MNT_NOATIME)
+		request_mask &= ~STATX_ATIME;
+	xcfs_sync_attr(d_inode(path->dentry), request_mask);
 	generic_fillattr(d_inode(path->dentry), stat);
+	/* fields left out above may be stale, so don't claim them */
+	stat->result_mask &= request_mask | ~XCFS_SYNC_ATTR_MASK;
 	stat->blocks = lower_stat.blocks;
+	if (!(lower_stat.result_mask & STATX_BLOCKS))
+		stat->result_mask &= ~STATX_BLOCKS;
 out:
-	xcfs_put_lower_path(path->dentry, &lower_path);
+	xcfs_stat_inc(path->dentry->d_sb, XCFS_STAT_GETATTR);
+	trace_xcfs_getattr(d_inode(path->dentry), request_mask, err);
 	return err;
 }
 /*
@@ -462,7 +572,7 @@ static int xcfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	struct kstat lower_stat;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	err = vfs_getattr(&lower_path, &lower_stat, STATX_INO, AT_STATX_SYNC_AS_STAT);
 	if (err)
 		goto out;
@@ -471,7 +581,6 @@ static int xcfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	generic_fillattr(d_inode(dentry), stat);
 	stat->blocks = lower_stat.blocks;
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
 	return err;
 }
 */
@@ -483,19 +592,20 @@ xcfs_setxattr(struct dentry *dentry, struct inode *inode, const char *name,
 	int err; struct dentry *lower_dentry;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	if (!(d_inode(lower_dentry)->i_opflags & IOP_XATTR)) {
 		err = -EOPNOTSUPP;
 		goto out;
 	}
 	err = vfs_setxattr(lower_dentry, name, value, size, flags);
+	xcfs_xattr_cache_invalidate(inode);
 	if (err)
 		goto out;
 	fsstack_copy_attr_all(d_inode(dentry),
 			      d_inode(lower_path.dentry));
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	trace_xcfs_setxattr(inode, name, size, err);
 	return err;
 }
 
@@ -508,20 +618,19 @@ xcfs_getxattr(struct dentry *dentry, struct inode *inode,
 	struct inode *lower_inode;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_inode = xcfs_lower_inode(inode);
 	if (!(d_inode(lower_dentry)->i_opflags & IOP_XATTR)) {
 		err = -EOPNOTSUPP;
 		goto out;
 	}
-	err = vfs_getxattr(lower_dentry, name, buffer, size);
+	err = xcfs_xattr_cache_get(inode, lower_dentry, name, buffer, size);
 	if (err)
 		goto out;
-	fsstack_copy_attr_atime(d_inode(dentry),
-				d_inode(lower_path.dentry));
+	xcfs_mark_attr_stale(d_inode(dentry), XCFS_STALE_ATIME);
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	trace_xcfs_getxattr(inode, name, size, err);
 	return err;
 }
 
@@ -532,19 +641,20 @@ xcfs_listxattr(struct dentry *dentry, char *buffer, size_t buffer_size)
 	struct dentry *lower_dentry;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	if (!(d_inode(lower_dentry)->i_opflags & IOP_XATTR)) {
 		err = -EOPNOTSUPP;
 		goto out;
 	}
-	err = vfs_listxattr(lower_dentry, buffer, buffer_size);
+	err = xcfs_xattr_cache_list(d_inode(dentry), lower_dentry, buffer,
+				    buffer_size);
 	if (err)
 		goto out;
-	fsstack_copy_attr_atime(d_inode(dentry),
-				d_inode(lower_path.dentry));
+	xcfs_mark_attr_stale(d_inode(dentry), XCFS_STALE_ATIME);
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	xcfs_stat_inc(dentry->d_sb, XCFS_STAT_LISTXATTR);
+	trace_xcfs_listxattr(d_inode(dentry), "", buffer_size, err);
 	return err;
 }
 
@@ -556,7 +666,7 @@ xcfs_removexattr(struct dentry *dentry, struct inode *inode, const char *name)
 	struct inode *lower_inode;
 	struct path lower_path;
 
-	xcfs_get_lower_path(dentry, &lower_path);
+	xcfs_peek_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_inode = xcfs_lower_inode(inode);
 	if (!(lower_inode->i_opflags & IOP_XATTR)) {
@@ -564,16 +674,16 @@ xcfs_removexattr(struct dentry *dentry, struct inode *inode, const char *name)
 		goto out;
 	}
 	err = vfs_removexattr(lower_dentry, name);
+	xcfs_xattr_cache_invalidate(inode);
 	if (err)
 		goto out;
 	fsstack_copy_attr_all(d_inode(dentry), lower_inode);
 out:
-	xcfs_put_lower_path(dentry, &lower_path);
+	trace_xcfs_removexattr(inode, name, 0, err);
 	return err;
 }
 
 const struct inode_operations xcfs_symlink_iops = {
-	.readlink	= xcfs_readlink,
 	.permission	= xcfs_permission,
 	.setattr	= xcfs_setattr,
 	.getattr	= xcfs_getattr,
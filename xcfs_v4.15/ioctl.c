@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include "xcfs_ioctl.h"
+
+/* largest buffer one XCFS_IOC_READDIRPLUS call fills */
+#define XCFS_RDP_MAX_BUF	(4 << 20)
+
+struct xcfs_rdp_ctx {
+	struct dir_context ctx;
+	char *buf;
+	size_t len;
+	size_t used;
+	bool full;
+};
+
+/*
+ * First pass, under the lower directory's lock: lay the records out in
+ * our buffer with only the name, ino and type filled in.  The lower
+ * lookups for the attributes happen after iterate_dir() has dropped the
+ * lock.
+ */
+static int xcfs_rdp_filldir(struct dir_context *ctx, const char *name,
+			    int namelen, loff_t offset, u64 ino,
+			    unsigned int d_type)
+{
+	struct xcfs_rdp_ctx *rc = container_of(ctx, struct xcfs_rdp_ctx, ctx);
+	struct xcfs_dirent_plus *de;
+	size_t reclen = ALIGN(sizeof(*de) + namelen + 1, sizeof(u64));
+
+	if (name[0] == '.' &&
+	    (namelen == 1 || (namelen == 2 && name[1] == '.')))
+		return 0;
+	if (rc->used + reclen > rc->len) {
+		rc->full = true;
+		return -ENOSPC;
+	}
+
+	de = (struct xcfs_dirent_plus *)(rc->buf + rc->used);
+	memset(de, 0, sizeof(*de));
+	de->ino = ino;
+	de->reclen = reclen;
+	de->namelen = namelen;
+	de->type = d_type;
+	memcpy(de->name, name, namelen);
+	de->name[namelen] = '\0';
+	rc->used += reclen;
+	return 0;
+}
+
+/*
+ * Second pass: fill in attributes from the lower inode cache and squeeze
+ * out entries that went away in between.  Returns the bytes kept.
+ */
+static size_t xcfs_rdp_fill_attrs(struct dentry *lower_dir, char *buf,
+				  size_t used, u32 *count)
+{
+	size_t in, out = 0;
+
+	for (in = 0; in < used; ) {
+		struct xcfs_dirent_plus *de = (void *)(buf + in);
+		size_t reclen = de->reclen;
+		struct dentry *lower_dentry;
+		struct inode *lower_inode;
+
+		in += reclen;
+		lower_dentry = lookup_one_len_unlocked(de->name, lower_dir,
+						       de->namelen);
+		if (IS_ERR(lower_dentry))
+			continue;
+		lower_inode = d_inode(lower_dentry);
+		if (!lower_inode) {
+			dput(lower_dentry);
+			continue;
+		}
+		de->ino = lower_inode->i_ino;
+		de->size = i_size_read(lower_inode);
+		de->mtime_sec = lower_inode->i_mtime.tv_sec;
+		de->mtime_nsec = lower_inode->i_mtime.tv_nsec;
+		de->mode = lower_inode->i_mode;
+		dput(lower_dentry);
+
+		if ((char *)de != buf + out)
+			memmove(buf + out, de, reclen);
+		out += reclen;
+		(*count)++;
+	}
+	return out;
+}
+
+static long xcfs_ioctl_readdirplus(struct file *file, void __user *arg)
+{
+	struct xcfs_rdp_ctx rc = {
+		.ctx.actor = xcfs_rdp_filldir,
+	};
+	struct xcfs_readdirplus req;
+	struct file *lower_dir_file;
+	struct path lower_path;
+	size_t out;
+	long err;
+
+	if (!S_ISDIR(file_inode(file)->i_mode))
+		return -ENOTDIR;
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+	if (req.pos < 0)
+		return -EINVAL;
+
+	rc.len = min_t(size_t, req.buf_len, XCFS_RDP_MAX_BUF);
+	rc.buf = kvmalloc(max_t(size_t, rc.len, 1), GFP_KERNEL);
+	if (!rc.buf)
+		return -ENOMEM;
+
+	/* a private lower file, so concurrent callers don't share f_pos */
+	xcfs_peek_lower_path(file->f_path.dentry, &lower_path);
+	lower_dir_file = dentry_open(&lower_path, O_RDONLY | O_DIRECTORY,
+				     current_cred());
+	if (IS_ERR(lower_dir_file)) {
+		err = PTR_ERR(lower_dir_file);
+		goto out_free;
+	}
+	err = vfs_llseek(lower_dir_file, req.pos, SEEK_SET);
+	if (err < 0)
+		goto out_fput;
+	rc.ctx.pos = lower_dir_file->f_pos;
+	err = iterate_dir(lower_dir_file, &rc.ctx);
+	/* ->full means we stopped early, not that listing failed */
+	if (err < 0 && !(rc.full && rc.used))
+		goto out_fput;
+	if (rc.full && !rc.used) {
+		err = -EINVAL;	/* buffer too small for one record */
+		goto out_fput;
+	}
+
+	req.count = 0;
+	out = xcfs_rdp_fill_attrs(lower_path.dentry, rc.buf, rc.used,
+				  &req.count);
+	req.pos = rc.ctx.pos;
+	req.flags = rc.full ? 0 : XCFS_RDP_EOF;
+
+	err = 0;
+	if (copy_to_user(u64_to_user_ptr(req.buf), rc.buf, out) ||
+	    copy_to_user(arg, &req, sizeof(req)))
+		err = -EFAULT;
+	xcfs_mark_attr_stale(file_inode(file), XCFS_STALE_ATIME);
+
+out_fput:
+	fput(lower_dir_file);
+out_free:
+	kvfree(rc.buf);
+	return err;
+}
+
+/* pages of @mapping carrying radix tree tag @tag */
+static u64 xcfs_count_tagged(struct address_space *mapping, int tag)
+{
+	struct radix_tree_iter iter;
+	void **slot;
+	u64 count = 0;
+
+	if (!mapping_tagged(mapping, tag))
+		return 0;
+	rcu_read_lock();
+	radix_tree_for_each_tagged(slot, &mapping->page_tree, &iter, 0, tag) {
+		count++;
+		if (need_resched()) {
+			slot = radix_tree_iter_resume(slot, &iter);
+			cond_resched_rcu();
+		}
+	}
+	rcu_read_unlock();
+	return count;
+}
+
+static long xcfs_ioctl_filestats(struct file *file, void __user *arg)
+{
+	struct inode *inode = file_inode(file);
+	struct address_space *upper = inode->i_mapping;
+	struct address_space *lower = xcfs_lower_inode(inode)->i_mapping;
+	struct xcfs_filestats st;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+
+	memset(&st, 0, sizeof(st));
+	st.upper_pages = READ_ONCE(upper->nrpages);
+	st.upper_dirty = xcfs_count_tagged(upper, PAGECACHE_TAG_DIRTY);
+	st.upper_writeback = xcfs_count_tagged(upper, PAGECACHE_TAG_WRITEBACK);
+	st.lower_pages = READ_ONCE(lower->nrpages);
+	st.lower_dirty = xcfs_count_tagged(lower, PAGECACHE_TAG_DIRTY);
+	st.lower_writeback = xcfs_count_tagged(lower, PAGECACHE_TAG_WRITEBACK);
+	st.pages_decrypted = atomic64_read(&XCFS_I(inode)->pages_decrypted);
+	st.pages_encrypted = atomic64_read(&XCFS_I(inode)->pages_encrypted);
+
+	if (copy_to_user(arg, &st, sizeof(st)))
+		return -EFAULT;
+	return 0;
+}
+
+/* ioctls xcfs handles itself; -ENOIOCTLCMD passes @cmd to the lower file */
+long xcfs_ioctl(struct file *file, unsigned int cmd, void __user *arg)
+{
+	switch (cmd) {
+	case XCFS_IOC_READDIRPLUS:
+		return xcfs_ioctl_readdirplus(file, arg);
+	case XCFS_IOC_FILESTATS:
+		return xcfs_ioctl_filestats(file, arg);
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
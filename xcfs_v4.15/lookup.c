@@ -10,6 +10,7 @@
  */
 
 #include "xcfs.h"
+#include "xcfs_trace.h"
 
 /* The dentry cache is just so we have properly sized dentries */
 static struct kmem_cache *xcfs_dentry_cachep;
@@ -17,7 +18,6 @@ static struct kmem_cache *xcfs_dentry_cachep;
 
 int xcfs_init_dentry_cache(void)
 {
-  printk(KERN_INFO "xcfs_init_dentry_cache");
 	xcfs_dentry_cachep =
 		kmem_cache_create("xcfs_dentry",
 				  sizeof(struct xcfs_dentry_info),
@@ -28,16 +28,24 @@ int xcfs_init_dentry_cache(void)
 
 void xcfs_destroy_dentry_cache(void)
 {
-  printk(KERN_INFO "xcfs_destroy_dentry_cache");
+	/* wait for pending xcfs_d_callback()s */
+	rcu_barrier();
 	if (xcfs_dentry_cachep)
 		kmem_cache_destroy(xcfs_dentry_cachep);
 }
 
+static void xcfs_d_callback(struct rcu_head *head)
+{
+	kmem_cache_free(xcfs_dentry_cachep,
+			container_of(head, struct xcfs_dentry_info, rcu));
+}
+
+/* RCU-walk d_revalidate may still be looking at it, see dentry.c */
 void free_dentry_private_data(struct dentry *dentry)
 {
 	if (!dentry || !dentry->d_fsdata)
 		return;
-	kmem_cache_free(xcfs_dentry_cachep, dentry->d_fsdata);
+	call_rcu(&XCFS_D(dentry)->rcu, xcfs_d_callback);
 	dentry->d_fsdata = NULL;
 }
 
@@ -46,17 +54,67 @@ int new_dentry_private_data(struct dentry *dentry)
 {
 	struct xcfs_dentry_info *info = XCFS_D(dentry);
 
-	/* use zalloc to init dentry_info.lower_path */
-	info = kmem_cache_zalloc(xcfs_dentry_cachep, GFP_ATOMIC);
+	/* use zalloc to init dentry_info.lower_dentry */
+	info = kmem_cache_zalloc(xcfs_dentry_cachep, GFP_KERNEL);
 	if (!info)
 		return -ENOMEM;
 
-	spin_lock_init(&info->lock);
 	dentry->d_fsdata = info;
 
 	return 0;
 }
 
+/*
+ * Per-superblock hash of upper inodes keyed by the lower inode pointer.
+ * Lookups run under RCU with no global lock; only a miss falls back to
+ * iget5_locked() and the global inode_hash_lock.
+ */
+static const struct rhashtable_params xcfs_inode_hash_params = {
+	.key_len		= sizeof(struct inode *),
+	.key_offset		= offsetof(struct xcfs_inode_info, lower_inode),
+	.head_offset		= offsetof(struct xcfs_inode_info, hash_node),
+	.automatic_shrinking	= true,
+};
+
+int xcfs_init_inode_hash(struct super_block *sb)
+{
+	return rhashtable_init(&XCFS_SB(sb)->inode_hash,
+			       &xcfs_inode_hash_params);
+}
+
+void xcfs_destroy_inode_hash(struct super_block *sb)
+{
+	rhashtable_destroy(&XCFS_SB(sb)->inode_hash);
+}
+
+/* called from evict, before the lower inode is released */
+void xcfs_unhash_inode(struct inode *inode)
+{
+	struct xcfs_inode_info *info = XCFS_I(inode);
+
+	if (!info->lower_inode)
+		return;
+	rhashtable_remove_fast(&XCFS_SB(inode->i_sb)->inode_hash,
+			       &info->hash_node, xcfs_inode_hash_params);
+}
+
+/* lockless hit path: returns a referenced inode or NULL */
+static struct inode *xcfs_iget_fast(struct super_block *sb,
+				    struct inode *lower_inode)
+{
+	struct xcfs_inode_info *info;
+	struct inode *inode = NULL;
+
+	rcu_read_lock();
+	info = rhashtable_lookup_fast(&XCFS_SB(sb)->inode_hash, &lower_inode,
+				      xcfs_inode_hash_params);
+	/* igrab fails on inodes being freed; the slow path waits for them */
+	if (info)
+		inode = igrab(&info->vfs_inode);
+	rcu_read_unlock();
+	return inode;
+}
+
 static int xcfs_inode_test(struct inode *inode, void *candidate_lower_inode)
 {
 	struct inode *current_lower_inode = xcfs_lower_inode(inode);
@@ -76,9 +134,17 @@ struct inode *xcfs_iget(struct super_block *sb, struct inode *lower_inode)
 {
 	struct xcfs_inode_info *info;
 	struct inode *inode; /* the new inode to return */
-  printk(KERN_INFO "xcfs_iget");
-	if (!igrab(lower_inode))
+
+	inode = xcfs_iget_fast(sb, lower_inode);
+	if (inode) {
+		trace_xcfs_iget(sb, lower_inode, 0);
+		return inode;
+	}
+
+	if (!igrab(lower_inode)) {
+		trace_xcfs_iget(sb, lower_inode, -ESTALE);
 		return ERR_PTR(-ESTALE);
+	}
 	inode = iget5_locked(sb, /* our superblock */
 			     /*
 			      * hashval: we use inode number, but we can
@@ -90,11 +156,13 @@ struct inode *xcfs_iget(struct super_block *sb, struct inode *lower_inode)
 			     xcfs_inode_set, /* inode init function */
 			     lower_inode); /* data passed to test+set fxns */
 	if (!inode) {
+		trace_xcfs_iget(sb, lower_inode, -ENOMEM);
 		iput(lower_inode);
 		return ERR_PTR(-ENOMEM);
 	}
 	/* if found a cached inode, then just return it (after iput) */
 	if (!(inode->i_state & I_NEW)) {
+		trace_xcfs_iget(sb, lower_inode, 1);
 		iput(lower_inode);
 		return inode;
 	}
@@ -141,6 +209,11 @@ struct inode *xcfs_iget(struct super_block *sb, struct inode *lower_inode)
 	fsstack_copy_inode_size(inode, lower_inode);
 
 	unlock_new_inode(inode);
+
+	/* a failed insert only costs later lookups the slow path */
+	rhashtable_lookup_insert_fast(&XCFS_SB(sb)->inode_hash,
+				      &info->hash_node, xcfs_inode_hash_params);
+	trace_xcfs_iget(sb, lower_inode, 2);
 	return inode;
 }
 
@@ -196,7 +269,7 @@ int xcfs_interpose(struct dentry *dentry, struct super_block *sb,
 		     struct path *lower_path)
 {
 	struct dentry *ret_dentry;
-  printk(KERN_INFO "xcfs_interpose");
+
 	ret_dentry = __xcfs_interpose(dentry, sb, lower_path);
 	return PTR_ERR(ret_dentry);
 }
@@ -236,12 +309,19 @@ static struct dentry *__xcfs_lookup(struct dentry *dentry,
 	lower_dir_dentry = lower_parent_path->dentry;
 	lower_dir_mnt = lower_parent_path->mnt;
 
+	xcfs_inject(dentry->d_sb, XCFS_INJ_LOOKUP, 0);
 	/* Use vfs_path_lookup to check if the dentry exists or not */
 	err = vfs_path_lookup(lower_dir_dentry, lower_dir_mnt, name, 0, &lower_path);
 	//err = vfs_path_lookup(lower_dir_mnt->mnt_root, lower_dir_mnt, name, 0, &lower_path);
 
 	/* no error: handle positive dentries */
 	if (!err) {
+		/* all our dentries share the superblock's lower mount */
+		if (lower_path.mnt != xcfs_lower_mnt(dentry->d_sb)) {
+			path_put(&lower_path);
+			err = -EXDEV;
+			goto out;
+		}
 		xcfs_set_lower_path(dentry, &lower_path);
 		ret_dentry =
 			__xcfs_interpose(dentry, dentry->d_sb, &lower_path);
@@ -300,10 +380,13 @@ struct dentry *xcfs_lookup(struct inode *dir, struct dentry *dentry,
 	int err;
 	struct dentry *ret, *parent;
 	struct path lower_parent_path;
-  printk(KERN_INFO "xcfs_lookup");
+	struct xcfs_op_timer timer;
+
+	xcfs_timer_start(dir->i_sb, &timer, dir->i_ino, 0, 0);
+	xcfs_prefetch_note_lookup(dir);
 	parent = dget_parent(dentry);
 
-	xcfs_get_lower_path(parent, &lower_parent_path);
+	xcfs_peek_lower_path(parent, &lower_parent_path);
 
 	/* allocate dentry private data.  We free it in ->d_release */
 	err = new_dentry_private_data(dentry);
@@ -317,14 +400,14 @@ struct dentry *xcfs_lookup(struct inode *dir, struct dentry *dentry,
 	if (ret)
 		dentry = ret;
 	if (d_inode(dentry))
-		fsstack_copy_attr_times(d_inode(dentry),
-					xcfs_lower_inode(d_inode(dentry)));
-	/* update parent directory's atime */
-	fsstack_copy_attr_atime(d_inode(parent),
-				xcfs_lower_inode(d_inode(parent)));
+		xcfs_mark_attr_stale(d_inode(dentry), XCFS_STALE_TIMES);
+	/* parent directory's atime is pulled up on its next getattr */
+	xcfs_mark_attr_stale(d_inode(parent), XCFS_STALE_ATIME);
 
 out:
-	xcfs_put_lower_path(parent, &lower_parent_path);
+	xcfs_timer_end(dir->i_sb, &timer, XCFS_LAT_LOOKUP);
+	xcfs_stat_inc(dir->i_sb, XCFS_STAT_LOOKUP);
+	trace_xcfs_lookup(dir, dentry, IS_ERR(ret) ? PTR_ERR(ret) : 0);
 	dput(parent);
 	return ret;
 }
@@ -12,6 +12,15 @@
 #include "xcfs.h"
 #include <linux/module.h>
 
+#define CREATE_TRACE_POINTS
+#include "xcfs_trace.h"
+
+/* what xcfs_mount() hands to xcfs_read_super() */
+struct xcfs_mount_data {
+	const char *dev_name;	/* the lower directory */
+	char *options;
+};
+
 /*
  * There is no need to lock the xcfs_super_info's rwsem as there is no
  * way anyone can have a reference to the superblock at this point in time.
@@ -21,9 +30,11 @@ static int xcfs_read_super(struct super_block *sb, void *raw_data, int silent)
 	int err = 0;
 	struct super_block *lower_sb;
 	struct path lower_path;
-	char *dev_name = (char *) raw_data;
+	struct xcfs_mount_data *data = raw_data;
+	const char *dev_name = data->dev_name;
+	struct xcfs_mount_opts opts;
 	struct inode *inode;
-  printk(KERN_INFO "XCFS_READ_SUPER");
+
 	if (!dev_name) {
 		printk(KERN_ERR
 		       "xcfs: read_super: missing dev_name argument\n");
@@ -52,6 +63,36 @@ static int xcfs_read_super(struct super_block *sb, void *raw_data, int silent)
 	lower_sb = lower_path.dentry->d_sb;
 	atomic_inc(&lower_sb->s_active);
 	xcfs_set_lower_super(sb, lower_sb);
+	/* every dentry in this mount shares the lower mount */
+	XCFS_SB(sb)->lower_mnt = mntget(lower_path.mnt);
+	XCFS_SB(sb)->lower_root = dget(lower_path.dentry);
+	XCFS_SB(sb)->cred = get_current_cred();
+	xcfs_init_statfs(sb);
+
+	xcfs_default_options(sb, &opts);
+	err = xcfs_parse_options(data->options, &opts);
+	if (err)
+		goto out_sput;
+	/* our own bdi, for readahead and writeback of dirty pages */
+	err = super_setup_bdi(sb);
+	if (err)
+		goto out_sput;
+	XCFS_SB(sb)->wq = alloc_workqueue("xcfs-%u:%u", WQ_UNBOUND,
+					  opts.workers, MAJOR(sb->s_dev),
+					  MINOR(sb->s_dev));
+	if (!XCFS_SB(sb)->wq) {
+		err = -ENOMEM;
+		goto out_sput;
+	}
+	xcfs_set_options(sb, &opts);
+
+	err = xcfs_init_inode_hash(sb);
+	if (err)
+		goto out_wq;
+	err = xcfs_stats_init_sb(sb);
+	if (err)
+		goto out_hash;
+	xcfs_inject_init_sb(sb);
 
 	/* inherit maxbytes from lower file system */
 	sb->s_maxbytes = lower_sb->s_maxbytes;
@@ -71,7 +112,7 @@ static int xcfs_read_super(struct super_block *sb, void *raw_data, int silent)
 	inode = xcfs_iget(sb, d_inode(lower_path.dentry));
 	if (IS_ERR(inode)) {
 		err = PTR_ERR(inode);
-		goto out_sput;
+		goto out_stats;
 	}
 	sb->s_root = d_make_root(inode);
 	if (!sb->s_root) {
@@ -108,25 +149,37 @@ out_freeroot:
 	dput(sb->s_root);
 out_iput:
 	iput(inode);
+out_stats:
+	xcfs_stats_destroy_sb(sb);
+out_hash:
+	xcfs_destroy_inode_hash(sb);
+out_wq:
+	destroy_workqueue(XCFS_SB(sb)->wq);
 out_sput:
 	/* drop refs we took earlier */
 	atomic_dec(&lower_sb->s_active);
+	dput(XCFS_SB(sb)->lower_root);
+	mntput(XCFS_SB(sb)->lower_mnt);
+	put_cred(XCFS_SB(sb)->cred);
 	kfree(XCFS_SB(sb));
 	sb->s_fs_info = NULL;
 out_free:
 	path_put(&lower_path);
 
 out:
+	trace_xcfs_read_super(sb, sb->s_flags, err);
 	return err;
 }
 
 struct dentry *xcfs_mount(struct file_system_type *fs_type, int flags,
 			    const char *dev_name, void *raw_data)
 {
-	void *lower_path_name = (void *) dev_name;
+	struct xcfs_mount_data data = {
+		.dev_name = dev_name,
+		.options = raw_data,
+	};
 
-	return mount_nodev(fs_type, flags, lower_path_name,
-			   xcfs_read_super);
+	return mount_nodev(fs_type, flags, &data, xcfs_read_super);
 }
 
 static struct file_system_type xcfs_fs_type = {
@@ -150,9 +203,16 @@ static int __init init_xcfs_fs(void)
 	err = xcfs_init_dentry_cache();
 	if (err)
 		goto out;
+	xcfs_cipher_select();
+	err = xcfs_init_sysfs();
+	if (err)
+		goto out;
+	xcfs_init_debugfs();
 	err = register_filesystem(&xcfs_fs_type);
 out:
 	if (err) {
+		xcfs_destroy_debugfs();
+		xcfs_destroy_sysfs();
 		xcfs_destroy_inode_cache();
 		xcfs_destroy_dentry_cache();
 	}
@@ -161,6 +221,8 @@ out:
 
 static void __exit exit_xcfs_fs(void)
 {
+	xcfs_destroy_debugfs();
+	xcfs_destroy_sysfs();
 	xcfs_destroy_inode_cache();
 	xcfs_destroy_dentry_cache();
 	unregister_filesystem(&xcfs_fs_type);
@@ -10,20 +10,7 @@
  */
 
 #include "xcfs.h"
-// ENCRYPT AND DECRYPT OPERATIONS
-void xcfs_encrypt(unsigned char *data, ssize_t count) {
-	ssize_t index = 0;
-	for (index = 0; index < count; index++) {
-		data[index]++;	
-	}
-}
-
-void xcfs_decrypt(unsigned char *data, ssize_t count) {
-	ssize_t index = 0;
-	for (index = 0; index < count; index++) {
-		data[index]--;	
-	}
-}
+#include "xcfs_trace.h"
 
 static ssize_t xcfs_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
 {
@@ -39,7 +26,7 @@ static int xcfs_readpage(struct file *file, struct page *page)
 {
 	int err = 0;
 	struct file *lower_file;
-	struct inode *inode;
+	struct inode *inode = page->mapping->host;
 	char *page_data = NULL;
 	struct xcfs_sb_info *xcfsb;
 	char *dpage_data;
@@ -47,44 +34,62 @@ static int xcfs_readpage(struct file *file, struct page *page)
 	mm_segment_t old_fs;
 	char* cipher;
 	struct page *cipher_page;
+	loff_t lower_pos = page_offset(page);
+	struct super_block *sb = inode->i_sb;
+	struct xcfs_op_timer timer;
 
+	xcfs_timer_start(sb, &timer, inode->i_ino, lower_pos, PAGE_SIZE);
 	cipher_page = alloc_page(GFP_KERNEL);
   //alloc page for the decrypted data
 	xcfsb = NULL;
 	dpage_data = NULL;
 
-	if (IS_ERR(cipher_page)){
-		err = PTR_ERR(cipher_page);
+	if (!cipher_page) {
+		err = -ENOMEM;
 		goto out;
 	}
 
 	cipher = kmap(cipher_page);
   //get a char* to the page data
 
-	BUG_ON(file == NULL);
-
-	lower_file = xcfs_lower_file(file);
-	BUG_ON(lower_file == NULL);
+	/*
+	 * Read through the inode's shared lower file, so @file may be NULL
+	 * (readahead, splice); the caller's own lower file is only a
+	 * fallback if that cannot be opened.  The shared file's f_pos is
+	 * never used, we pass our own position.
+	 */
+	lower_file = xcfs_shared_lower_file(inode);
+	if (IS_ERR(lower_file) && file && XCFS_F(file) &&
+	    XCFS_F(file)->lower_file)
+		lower_file = XCFS_F(file)->lower_file;
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
 
-	inode = file->f_path.dentry->d_inode;
 	page_data = (char *) kmap(page);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_READPAGE_ALLOC);
 
-	//set the pointer of lower file
-	lower_file->f_pos = page_offset(page);
+	/* not under the lower inode lock, it would serialize all its users */
+	xcfs_inject(sb, XCFS_INJ_READ, PAGE_SIZE);
 	inode_lock(lower_file->f_path.dentry->d_inode);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_READPAGE_LOCK);
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 	/*** generic_file_splice_write may call us on a file not opened for
 	** reading, so temporarily allow reading.
 	**/
 	orig_mode = lower_file->f_mode;
-	lower_file->f_mode |= FMODE_READ;
-	xcfsb = (struct xcfs_sb_info *) file->f_path.dentry->d_sb->s_fs_info;
-	err = vfs_read(lower_file, cipher, PAGE_SIZE, &lower_file->f_pos);
+	if (!(orig_mode & FMODE_READ))
+		lower_file->f_mode |= FMODE_READ;
+	xcfsb = XCFS_SB(sb);
+	err = vfs_read(lower_file, cipher, PAGE_SIZE, &lower_pos);
   //read into the cipher char from the lower file
  
-	lower_file->f_mode = orig_mode;
+	if (!(orig_mode & FMODE_READ))
+		lower_file->f_mode = orig_mode;
 	set_fs(old_fs);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_READPAGE_READ);
   //repalace with old_fs
   //
 	if (err < 0) {
@@ -92,7 +97,13 @@ static int xcfs_readpage(struct file *file, struct page *page)
 	}    
 	memcpy(page_data, cipher, PAGE_SIZE);
 	/* key -> decrypt and vfs_read */
-	xcfs_decrypt(page_data, PAGE_SIZE);
+	xcfs_sb_decrypt(sb, page_data, PAGE_SIZE);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_READPAGE_DECRYPT);
+	xcfs_stat_inc(sb, XCFS_STAT_LOWER_READS);
+	xcfs_stat_add(sb, XCFS_STAT_LOWER_READ_BYTES, err);
+	xcfs_stat_inc(sb, XCFS_STAT_PAGES_DECRYPTED);
+	atomic64_inc(&XCFS_I(inode)->pages_decrypted);
+	xcfs_stat_add(sb, XCFS_STAT_BYTES_DECRYPTED, PAGE_SIZE);
   //page_data has decrypted content which is mapped to page
 
 out_err:
@@ -104,14 +115,20 @@ out_err:
 	if (err < 0) {
 	  goto out;
 	}
+	/* cache=plain: the ciphertext is not needed again */
+	if (xcfs_cache_mode(sb) == XCFS_CACHE_PLAIN)
+		invalidate_mapping_pages(lower_file->f_mapping, page->index,
+					 page->index);
 	err = 0;
-	/* if vfs_read succeeded above, sync up our times */
-	fsstack_copy_attr_atime(inode, lower_file->f_path.dentry->d_inode);
+	/* if vfs_read succeeded above, our atime is synced up lazily */
+	xcfs_mark_attr_stale(inode, XCFS_STALE_ATIME);
 	kunmap(page);
 	flush_dcache_page(page);
 out :
-	kunmap(cipher_page);
-	__free_page(cipher_page);
+	if (cipher_page) {
+		kunmap(cipher_page);
+		__free_page(cipher_page);
+	}
   //unmap both the pages and free
 
 	if (err == 0) {
@@ -121,6 +138,9 @@ out :
 		ClearPageUptodate(page);
 	}
 
+	xcfs_timer_end(sb, &timer, XCFS_LAT_READPAGE);
+	xcfs_stat_inc(sb, XCFS_STAT_READPAGE);
+	trace_xcfs_readpage(page->mapping->host, page, err);
 	unlock_page(page);
     return err;
 }
@@ -128,84 +148,97 @@ out :
 /* 
  * xcfs_writepage writes page with reference to 
  * writeback_Control wbc
- * Similar to ecryptfs
+ * Similar to ecryptfs: the page is encrypted into a bounce page and
+ * written through the inode's writeback lower file, like write_end does.
+ * The lower ->writepage is never called; its pages may have no buffers
+ * attached, and vfs_write lets the lower fs allocate blocks as usual.
  */
 static int xcfs_writepage(struct page *page, struct writeback_control *wbc)
 {
-	int err = -EIO;
-	struct inode *inode;
-	struct inode *lower_inode;
-	struct page *lower_page;
-	struct address_space *lower_mapping; /* lower inode mapping */
-	gfp_t mask;
+	int err = 0;
+	struct inode *inode = page->mapping->host;
+	struct super_block *sb = inode->i_sb;
+	struct file *lower_file;
+	struct page *cipher_page;
+	loff_t lower_pos = page_offset(page);
+	loff_t size = i_size_read(inode);
+	size_t len = PAGE_SIZE;
+	mm_segment_t old_fs;
+	ssize_t ret;
+	struct xcfs_op_timer timer;
 
 	char *cipher, *plain;
-	BUG_ON(!PageUptodate(page));
-	inode = page->mapping->host;
-	/* if no lower inode, nothing to do */
-	if (!inode || !XCFS_I(inode)) {
-		err = 0;
-		goto out;
-	}
-	lower_inode = xcfs_lower_inode(inode);
-	lower_mapping = lower_inode->i_mapping;
+	XCFS_BUG_ON(!PageUptodate(page));
+	xcfs_timer_start(sb, &timer, inode->i_ino, lower_pos, PAGE_SIZE);
 	/*
-	 * find lower page (returns a locked page)
-	 *
-	 * We turn off __GFP_FS while we look for or create a new lower
-	 * page.  This prevents a recursion into the file system code, which
-	 * under memory pressure conditions could lead to a deadlock.  This
-	 * is similar to how the loop driver behaves (see loop_set_fd in
-	 * drivers/block/loop.c).  If we can't find the lower page, we
-	 * redirty our page and return "success" so that the VM will call us
-	 * again in the (hopefully near) future.
+	 * Writing goes through the lower file system, which may need memory
+	 * itself; leave pages to the flusher rather than recurse from
+	 * reclaim.
 	 */
-	mask = mapping_gfp_mask(lower_mapping) & ~(__GFP_FS);
-	lower_page = find_or_create_page(lower_mapping, page->index, mask);
-	if (!lower_page) {
-		err = 0;
-		set_page_dirty(page);
+	if (wbc->for_reclaim) {
+		redirty_page_for_writepage(wbc, page);
+		goto out;
+	}
+	/* truncated under us */
+	if (lower_pos >= size)
+		goto out;
+	/* stop at EOF, the lower file must not grow past our i_size */
+	if (size - lower_pos < PAGE_SIZE)
+		len = size - lower_pos;
+
+	/* opened when the page was dirtied, see xcfs_can_write_back() */
+	lower_file = xcfs_writeback_lower_file(inode);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out_err;
+	}
+	cipher_page = alloc_page(GFP_NOFS);
+	if (!cipher_page) {
+		/* try again on the next writeback pass */
+		redirty_page_for_writepage(wbc, page);
 		goto out;
 	}
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_WRITEPAGE_FILE);
 
 	plain = kmap(page);
-	cipher = kmap(lower_page);
-
+	cipher = kmap(cipher_page);
 	memcpy(cipher, plain, PAGE_SIZE);
-	xcfs_encrypt(cipher, PAGE_SIZE);
-  //encrypt the content of the page
-	/* copy page data from our upper page to the lower page */
-	copy_highpage(lower_page, page);
-	flush_dcache_page(lower_page);
-	SetPageUptodate(lower_page);
-	set_page_dirty(lower_page);
+	kunmap(page);
+	xcfs_sb_encrypt(sb, cipher, PAGE_SIZE);
+	xcfs_stat_inc(sb, XCFS_STAT_PAGES_ENCRYPTED);
+	atomic64_inc(&XCFS_I(inode)->pages_encrypted);
+	xcfs_stat_add(sb, XCFS_STAT_BYTES_ENCRYPTED, PAGE_SIZE);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_WRITEPAGE_ENCRYPT);
 
-	/*
-	 * Call lower writepage (expects locked page).  However, if we are
-	 * called with wbc->for_reclaim, then the VFS/VM just wants to
-	 * reclaim our page.  Therefore, we don't need to call the lower
-	 * ->writepage: just copy our data to the lower page (already done
-	 * above), then mark the lower page dirty and unlock it, and return
-	 * success.
-	 */
-	BUG_ON(!lower_mapping->a_ops->writepage);
-	wait_on_page_writeback(lower_page); /* prevent multiple writers */
-	clear_page_dirty_for_io(lower_page); /* emulate VFS behavior */
-	err = lower_mapping->a_ops->writepage(lower_page, wbc);
-	if (err < 0)
-		goto out_release;
-	if (err == AOP_WRITEPAGE_ACTIVATE) {
-		err = 0;
-		unlock_page(lower_page);
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	xcfs_inject(sb, XCFS_INJ_WRITEPAGE, len);
+	ret = vfs_write(lower_file, cipher, len, &lower_pos);
+	set_fs(old_fs);
+	kunmap(cipher_page);
+	__free_page(cipher_page);
+	xcfs_timer_phase(sb, &timer, XCFS_LAT_WRITEPAGE_LOWER);
+	if (ret < 0) {
+		err = ret;
+		goto out_err;
 	}
+	xcfs_stat_inc(sb, XCFS_STAT_LOWER_WRITES);
+	xcfs_stat_add(sb, XCFS_STAT_LOWER_WRITE_BYTES, ret);
+	if (ret < len) {
+		err = -EIO;
+		goto out_err;
+	}
+	/* writeback is a good time to catch up on lazy attributes */
+	xcfs_sync_stale_attr(inode);
+	goto out;
 
-out_release:
-	kunmap(page);
-	kunmap(lower_page);
-	/* b/c find_or_create_page increased refcnt */
-	put_page(lower_page);
-
+out_err:
+	/* the page is clean now; let fsync and close see the error */
+	mapping_set_error(page->mapping, err);
 out:
+	xcfs_timer_end(sb, &timer, XCFS_LAT_WRITEPAGE);
+	xcfs_stat_inc(sb, XCFS_STAT_WRITEPAGE);
+	trace_xcfs_writepage(inode, page, err);
 	unlock_page(page);
 	return err;
 }
@@ -225,8 +258,11 @@ static int xcfs_write_begin(struct file *file,
 	page = grab_cache_page_write_begin(mapping, index, flags);
   //get the page
 	if (!page)
-		return -ENOMEM;
-	*pagep = page;
+		rc = -ENOMEM;
+	else
+		*pagep = page;
+	xcfs_stat_inc(mapping->host->i_sb, XCFS_STAT_WRITE_BEGIN);
+	trace_xcfs_write_begin(mapping->host, pos, len, rc);
 	return rc;
 }
 
@@ -249,42 +285,66 @@ static int xcfs_write_end(struct file *file,
 	char *page_data = NULL;
 	mode_t orig_mode;
 	mm_segment_t old_fs;
+	loff_t lower_pos;
 
 	struct page *cipher_page;
 	char *cipher;
+	struct xcfs_op_timer timer;
 	cipher_page = NULL;
 
+	xcfs_timer_start(inode->i_sb, &timer, inode->i_ino, pos, copied);
 
 	if (!file || !XCFS_F(file)) {
 		err = 0;
 		goto out;
 	}
-	BUG_ON(file == NULL);
+	/*
+	 * write=back: a page that is now valid throughout only needs to be
+	 * dirtied; writepage encrypts it later.  A partial write to a page
+	 * never read, or one growing the file, still goes to the lower file
+	 * now, so the lower size never lags behind ours.
+	 */
+	if (READ_ONCE(XCFS_SB(inode->i_sb)->opts.write_back) &&
+	    (PageUptodate(page) || copied == PAGE_SIZE) &&
+	    pos + copied <= i_size_read(inode) &&
+	    xcfs_can_write_back(inode)) {
+		SetPageUptodate(page);
+		set_page_dirty(page);
+		err = copied;
+		goto out;
+	}
+	XCFS_BUG_ON(file == NULL);
 	lower_file = xcfs_lower_file(file);
-	BUG_ON(lower_file == NULL);
-	page_data = (char *) kmap(page);
-	
+	XCFS_BUG_ON(lower_file == NULL);
 	cipher_page = alloc_page(GFP_KERNEL);
-  //alloc a new page and map it to a char*
+	if (!cipher_page) {
+		err = -ENOMEM;
+		goto out;
+	}
+	page_data = (char *) kmap(page);
+  //map the new page to a char*
 	cipher = kmap(cipher_page);
 	memcpy(cipher, page_data, PAGE_SIZE);
-	xcfs_encrypt(cipher, PAGE_SIZE);
-	lower_file->f_pos = page_offset(page) + from;
-  //set the file position in the lower file
+	xcfs_sb_encrypt(inode->i_sb, cipher, PAGE_SIZE);
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_PAGES_ENCRYPTED);
+	atomic64_inc(&XCFS_I(inode)->pages_encrypted);
+	xcfs_stat_add(inode->i_sb, XCFS_STAT_BYTES_ENCRYPTED, PAGE_SIZE);
+	lower_pos = page_offset(page) + from;
+  //the file position in the lower file
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 	orig_mode = lower_file->f_mode;
 	lower_file->f_mode |= FMODE_WRITE;
-	err = vfs_write(lower_file, cipher+from, bytes, \
-				&lower_file->f_pos);
+	xcfs_inject(inode->i_sb, XCFS_INJ_WRITE, bytes);
+	err = vfs_write(lower_file, cipher+from, bytes, &lower_pos);
 
 	set_fs(old_fs);
 	kunmap(page);
 
-	if (err < 0) {
-		printk(KERN_INFO "vfs_write failed\n");
+	if (err < 0)
 		goto out;
-	}
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_LOWER_WRITES);
+	xcfs_stat_add(inode->i_sb, XCFS_STAT_LOWER_WRITE_BYTES, err);
 	/*
 	 * checking if lower_file has inode and then assigning 
 	 * lower_inode the inode from file.
@@ -293,19 +353,28 @@ static int xcfs_write_end(struct file *file,
 	if (!lower_inode) {
 		lower_inode = xcfs_lower_inode(inode);
 	}
-	BUG_ON(!lower_inode);
-	BUG_ON(!inode);
-	/* copying inode size and times */
-	fsstack_copy_inode_size(inode, lower_inode);
-	fsstack_copy_attr_times(inode, lower_inode);
-	mark_inode_dirty_sync(inode);
+	XCFS_BUG_ON(!lower_inode);
+	XCFS_BUG_ON(!inode);
+	/*
+	 * Only a growing size must be visible right away, to readers of our
+	 * page cache; times are pulled up lazily.  The upper inode has no
+	 * ->write_inode, so there is nothing to mark dirty.
+	 */
+	if (page_offset(page) + from + err > i_size_read(inode))
+		i_size_write(inode, page_offset(page) + from + err);
+	xcfs_mark_attr_stale(inode, XCFS_STALE_TIMES);
 out:
-	kunmap(cipher_page);
-	__free_page(cipher_page);
+	if (cipher_page) {
+		kunmap(cipher_page);
+		__free_page(cipher_page);
+	}
 
 	if (err < 0) {
 		ClearPageUptodate(page);
 	}
+	xcfs_timer_end(inode->i_sb, &timer, XCFS_LAT_WRITE_END);
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_WRITE_END);
+	trace_xcfs_write_end(inode, pos, copied, err);
 	unlock_page(page);
 	put_page(page);
 	return err;	
@@ -319,5 +388,6 @@ const struct address_space_operations xcfs_aops = {
 	.writepage = xcfs_writepage,
 	.write_begin = xcfs_write_begin,
 	.write_end = xcfs_write_end,
+	.set_page_dirty = __set_page_dirty_nobuffers,
 };
 
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/workqueue.h>
+#include <linux/cred.h>
+
+/*
+ * Readdir-plus prefetch.  "ls -l", rsync and find list a directory and
+ * then look up every name in it.  When lookups in a directory follow a
+ * listing closely enough, later listings of that directory hand the names
+ * they return to the mount's workqueue in small batches.  Up to workers=
+ * of them look the names up in the lower directory at once, so the lower
+ * inodes are read in parallel and our own ->lookup finds them in the
+ * lower caches.
+ */
+
+/* a lookup this soon after a listing counts towards the pattern */
+#define XCFS_PREFETCH_WINDOW	(2 * HZ)
+/* lookups after a listing before we start prefetching */
+#define XCFS_PREFETCH_THRESHOLD	8
+/* names per work item */
+#define XCFS_PREFETCH_BATCH	16
+/* cap on queued work items across all mounts */
+#define XCFS_PREFETCH_INFLIGHT	256
+
+struct xcfs_prefetch_work {
+	struct work_struct work;
+	struct path lower_dir;
+	const struct cred *cred;
+	unsigned int nr;
+	unsigned int used;
+	char names[];		/* length byte followed by the name */
+};
+
+#define XCFS_PREFETCH_BYTES \
+	(PAGE_SIZE - offsetof(struct xcfs_prefetch_work, names))
+
+struct xcfs_prefetch_ctx {
+	struct dir_context ctx;
+	struct dir_context *caller;
+	struct path lower_dir;
+	struct workqueue_struct *wq;	/* the mount's */
+	struct xcfs_prefetch_work *batch;
+};
+
+static atomic_t xcfs_prefetch_inflight = ATOMIC_INIT(0);
+
+static void xcfs_prefetch_worker(struct work_struct *work)
+{
+	struct xcfs_prefetch_work *pw =
+		container_of(work, struct xcfs_prefetch_work, work);
+	const struct cred *old_cred;
+	struct dentry *lower_dentry;
+	char *p = pw->names;
+	unsigned int i, len;
+
+	/* look names up with the permissions of whoever listed them */
+	old_cred = override_creds(pw->cred);
+	for (i = 0; i < pw->nr; i++) {
+		len = (unsigned char)*p++;
+		lower_dentry = lookup_one_len_unlocked(p, pw->lower_dir.dentry,
+						       len);
+		if (!IS_ERR(lower_dentry))
+			dput(lower_dentry);
+		p += len;
+	}
+	revert_creds(old_cred);
+
+	put_cred(pw->cred);
+	path_put(&pw->lower_dir);
+	kfree(pw);
+	atomic_dec(&xcfs_prefetch_inflight);
+}
+
+static void xcfs_prefetch_submit(struct xcfs_prefetch_ctx *pc)
+{
+	struct xcfs_prefetch_work *pw = pc->batch;
+
+	pc->batch = NULL;
+	if (!pw)
+		return;
+	if (!pw->nr) {
+		kfree(pw);
+		return;
+	}
+	INIT_WORK(&pw->work, xcfs_prefetch_worker);
+	pathcpy(&pw->lower_dir, &pc->lower_dir);
+	path_get(&pw->lower_dir);
+	pw->cred = get_current_cred();
+	atomic_inc(&xcfs_prefetch_inflight);
+	queue_work(pc->wq, &pw->work);
+}
+
+static void xcfs_prefetch_add(struct xcfs_prefetch_ctx *pc,
+			      const char *name, int namelen)
+{
+	struct xcfs_prefetch_work *pw = pc->batch;
+
+	/* "." and ".." need no lookup */
+	if (name[0] == '.' &&
+	    (namelen == 1 || (namelen == 2 && name[1] == '.')))
+		return;
+	if (namelen > NAME_MAX)
+		return;
+
+	if (pw && pw->used + 1 + namelen > XCFS_PREFETCH_BYTES)
+		xcfs_prefetch_submit(pc);
+	if (!pc->batch) {
+		if (atomic_read(&xcfs_prefetch_inflight) >=
+		    XCFS_PREFETCH_INFLIGHT)
+			return;
+		pc->batch = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!pc->batch)
+			return;
+		pc->batch->nr = 0;
+		pc->batch->used = 0;
+	}
+	pw = pc->batch;
+	pw->names[pw->used++] = namelen;
+	memcpy(pw->names + pw->used, name, namelen);
+	pw->used += namelen;
+	if (++pw->nr == XCFS_PREFETCH_BATCH)
+		xcfs_prefetch_submit(pc);
+}
+
+/* hands each name to the caller, then queues it for prefetch */
+static int xcfs_prefetch_filldir(struct dir_context *ctx, const char *name,
+				 int namelen, loff_t offset, u64 ino,
+				 unsigned int d_type)
+{
+	struct xcfs_prefetch_ctx *pc =
+		container_of(ctx, struct xcfs_prefetch_ctx, ctx);
+
+	pc->caller->pos = pc->ctx.pos;
+	if (!dir_emit(pc->caller, name, namelen, ino, d_type))
+		return -EINVAL;
+	xcfs_prefetch_add(pc, name, namelen);
+	return 0;
+}
+
+/* called from ->lookup on a dcache miss in @dir */
+void xcfs_prefetch_note_lookup(struct inode *dir)
+{
+	struct xcfs_inode_info *info = XCFS_I(dir);
+
+	if (time_after(jiffies,
+		       READ_ONCE(info->readdir_time) + XCFS_PREFETCH_WINDOW))
+		return;
+	if (atomic_read(&info->scan_lookups) < XCFS_PREFETCH_THRESHOLD)
+		atomic_inc(&info->scan_lookups);
+}
+
+/*
+ * List @file through @iterate, prefetching the returned names if the
+ * directory is being scanned.  @iterate is the readdir body proper.
+ */
+int xcfs_prefetch_readdir(struct file *file, struct dir_context *ctx,
+			  int (*iterate)(struct file *, struct dir_context *))
+{
+	struct inode *dir = file_inode(file);
+	struct xcfs_inode_info *info = XCFS_I(dir);
+	struct xcfs_prefetch_ctx pc = {
+		.ctx.actor = xcfs_prefetch_filldir,
+		.ctx.pos = ctx->pos,
+		.caller = ctx,
+		.wq = XCFS_SB(dir->i_sb)->wq,
+	};
+	int lookups = atomic_read(&info->scan_lookups);
+	bool scanning = lookups >= XCFS_PREFETCH_THRESHOLD;
+	int err;
+
+	if (READ_ONCE(info->readdir_time) != jiffies)
+		WRITE_ONCE(info->readdir_time, jiffies);
+	/* decay, so only directories still being scanned stay prefetched */
+	if (ctx->pos == 0 && lookups)
+		atomic_set(&info->scan_lookups, lookups / 2);
+	if (!scanning)
+		return iterate(file, ctx);
+
+	xcfs_peek_lower_path(file->f_path.dentry, &pc.lower_dir);
+	err = iterate(file, &pc.ctx);
+	ctx->pos = pc.ctx.pos;
+	xcfs_prefetch_submit(&pc);
+	return err;
+}
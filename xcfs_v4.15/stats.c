@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/debugfs.h>
+#include <linux/math64.h>
+
+/*
+ * Per-mount counters.  Hot paths bump a per-CPU copy with this_cpu_add,
+ * so counting costs no shared cachelines; readers of
+ * <debugfs>/xcfs/<major>:<minor>/stats get the sums.  The latency file
+ * next to it works the same way for the histograms, and writing to it
+ * clears them.  Operations slower than slow_threshold_us are also kept,
+ * with their phases, in a small ring shown by the slowops file.
+ *
+ * page_cache_hits and page_cache_misses split the pages read(2) asks
+ * for by whether they were cached before the read.  read_pages is the
+ * pages read(2) returned and readpage the pages filled from the lower
+ * file, readahead included, so those two do not make a hit rate.
+ */
+
+static struct dentry *xcfs_debugfs_root;
+
+/* default slow_threshold_us for new mounts */
+#define XCFS_SLOW_US_DEFAULT	50000
+
+static const char * const xcfs_stat_names[XCFS_STAT_NR] = {
+#define XCFS_STAT_NAME(id, name)	[XCFS_STAT_##id] = name,
+	XCFS_STATS(XCFS_STAT_NAME)
+#undef XCFS_STAT_NAME
+};
+
+static void xcfs_stats_sum(struct xcfs_sb_info *sbi, u64 *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(u64) * XCFS_STAT_NR);
+	for_each_possible_cpu(cpu) {
+		struct xcfs_stats *st = per_cpu_ptr(sbi->stats, cpu);
+
+		for (i = 0; i < XCFS_STAT_NR; i++)
+			sum[i] += READ_ONCE(st->count[i]);
+	}
+}
+
+static int xcfs_stats_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	u64 sum[XCFS_STAT_NR];
+	int i;
+
+	xcfs_stats_sum(XCFS_SB(sb), sum);
+	for (i = 0; i < XCFS_STAT_NR; i++)
+		seq_printf(m, "%s %llu\n", xcfs_stat_names[i], sum[i]);
+	return 0;
+}
+
+static const char * const xcfs_lat_names[XCFS_LAT_NR] = {
+#define XCFS_LAT_NAME(id, name)	[XCFS_LAT_##id] = name,
+	XCFS_LATENCIES(XCFS_LAT_NAME)
+#undef XCFS_LAT_NAME
+};
+
+static int xcfs_latency_show(struct seq_file *m, void *v)
+{
+	struct xcfs_sb_info *sbi = XCFS_SB((struct super_block *)m->private);
+	u64 hist[XCFS_LAT_BUCKETS], count, sum;
+	int lat, cpu, b;
+
+	for (lat = 0; lat < XCFS_LAT_NR; lat++) {
+		memset(hist, 0, sizeof(hist));
+		sum = 0;
+		for_each_possible_cpu(cpu) {
+			struct xcfs_latency *l = per_cpu_ptr(sbi->latency, cpu);
+
+			for (b = 0; b < XCFS_LAT_BUCKETS; b++)
+				hist[b] += READ_ONCE(l->hist[lat][b]);
+			sum += READ_ONCE(l->sum_ns[lat]);
+		}
+		for (count = 0, b = 0; b < XCFS_LAT_BUCKETS; b++)
+			count += hist[b];
+		if (!count)
+			continue;
+
+		seq_printf(m, "%s: count %llu avg_ns %llu\n",
+			   xcfs_lat_names[lat], count, div64_u64(sum, count));
+		for (b = 0; b < XCFS_LAT_BUCKETS; b++) {
+			if (!hist[b])
+				continue;
+			if (b == XCFS_LAT_BUCKETS - 1)
+				seq_printf(m, "  >= %llu ns: %llu\n",
+					   1ULL << b, hist[b]);
+			else
+				seq_printf(m, "  %llu-%llu ns: %llu\n",
+					   b ? 1ULL << b : 0,
+					   (1ULL << (b + 1)) - 1, hist[b]);
+		}
+	}
+	return 0;
+}
+
+static int xcfs_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xcfs_latency_show, inode->i_private);
+}
+
+/* any write clears the histograms; racing updates may survive it */
+static ssize_t xcfs_latency_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct xcfs_sb_info *sbi = XCFS_SB((struct super_block *)m->private);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(sbi->latency, cpu), 0,
+		       sizeof(struct xcfs_latency));
+	return count;
+}
+
+static const struct file_operations xcfs_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xcfs_latency_open,
+	.read		= seq_read,
+	.write		= xcfs_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* called from xcfs_timer_end() for operations over the threshold */
+void xcfs_slowop_record(struct super_block *sb, struct xcfs_op_timer *t,
+			enum xcfs_lat lat, u64 ns)
+{
+	struct xcfs_slowops *ring = XCFS_SB(sb)->slowops;
+	struct xcfs_slowop *op;
+	unsigned int i;
+
+	spin_lock(&ring->lock);
+	op = &ring->ops[ring->next];
+	ring->next = (ring->next + 1) % XCFS_SLOWOPS;
+	if (ring->count < XCFS_SLOWOPS)
+		ring->count++;
+
+	op->time_ns = t->start + ns;
+	op->total_ns = ns;
+	op->ino = t->ino;
+	op->pos = t->pos;
+	op->len = t->len;
+	op->pid = task_pid_nr(current);
+	op->op = lat;
+	op->nr_phases = t->nr_phases;
+	for (i = 0; i < t->nr_phases; i++) {
+		op->phase[i] = t->phase[i];
+		op->phase_ns[i] = t->phase_ns[i];
+	}
+	get_task_comm(op->comm, current);
+	spin_unlock(&ring->lock);
+}
+
+static int xcfs_slowops_show(struct seq_file *m, void *v)
+{
+	struct xcfs_slowops *ring =
+		XCFS_SB((struct super_block *)m->private)->slowops;
+	unsigned int i, j, slot;
+
+	spin_lock(&ring->lock);
+	/* oldest first */
+	slot = (ring->next + XCFS_SLOWOPS - ring->count) % XCFS_SLOWOPS;
+	for (i = 0; i < ring->count; i++) {
+		struct xcfs_slowop *op = &ring->ops[slot];
+
+		seq_printf(m, "%llu %s ino %lu pos %lld len %zu total_us %llu",
+			   op->time_ns, xcfs_lat_names[op->op], op->ino,
+			   op->pos, op->len,
+			   div_u64(op->total_ns, NSEC_PER_USEC));
+		for (j = 0; j < op->nr_phases; j++)
+			seq_printf(m, " %s_us %llu",
+				   xcfs_lat_names[op->phase[j]],
+				   div_u64(op->phase_ns[j], NSEC_PER_USEC));
+		seq_printf(m, " pid %d comm %s\n", op->pid, op->comm);
+		slot = (slot + 1) % XCFS_SLOWOPS;
+	}
+	spin_unlock(&ring->lock);
+	return 0;
+}
+
+static int xcfs_slowops_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xcfs_slowops_show, inode->i_private);
+}
+
+/* any write empties the ring */
+static ssize_t xcfs_slowops_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct xcfs_slowops *ring =
+		XCFS_SB((struct super_block *)m->private)->slowops;
+
+	spin_lock(&ring->lock);
+	ring->next = 0;
+	ring->count = 0;
+	spin_unlock(&ring->lock);
+	return count;
+}
+
+static const struct file_operations xcfs_slowops_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xcfs_slowops_open,
+	.read		= seq_read,
+	.write		= xcfs_slowops_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int xcfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xcfs_stats_show, inode->i_private);
+}
+
+static const struct file_operations xcfs_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xcfs_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int xcfs_stats_init_sb(struct super_block *sb)
+{
+	struct xcfs_sb_info *sbi = XCFS_SB(sb);
+	char name[32];
+
+	sbi->stats = alloc_percpu(struct xcfs_stats);
+	sbi->latency = alloc_percpu(struct xcfs_latency);
+	sbi->slowops = kzalloc(sizeof(*sbi->slowops), GFP_KERNEL);
+	if (!sbi->stats || !sbi->latency || !sbi->slowops) {
+		xcfs_stats_destroy_sb(sb);
+		return -ENOMEM;
+	}
+	spin_lock_init(&sbi->slowops->lock);
+	sbi->slow_us = XCFS_SLOW_US_DEFAULT;
+
+	/* debugfs is best effort; the mount works without it */
+	if (IS_ERR_OR_NULL(xcfs_debugfs_root))
+		return 0;
+	snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev),
+		 MINOR(sb->s_dev));
+	sbi->debugfs_dir = debugfs_create_dir(name, xcfs_debugfs_root);
+	if (IS_ERR_OR_NULL(sbi->debugfs_dir))
+		return 0;
+	debugfs_create_file("stats", 0444, sbi->debugfs_dir, sb,
+			    &xcfs_stats_fops);
+	debugfs_create_file("latency", 0644, sbi->debugfs_dir, sb,
+			    &xcfs_latency_fops);
+	debugfs_create_file("slowops", 0644, sbi->debugfs_dir, sb,
+			    &xcfs_slowops_fops);
+	debugfs_create_u32("slow_threshold_us", 0644, sbi->debugfs_dir,
+			   &sbi->slow_us);
+	return 0;
+}
+
+void xcfs_stats_destroy_sb(struct super_block *sb)
+{
+	struct xcfs_sb_info *sbi = XCFS_SB(sb);
+
+	debugfs_remove_recursive(sbi->debugfs_dir);
+	sbi->debugfs_dir = NULL;
+	free_percpu(sbi->stats);
+	sbi->stats = NULL;
+	free_percpu(sbi->latency);
+	sbi->latency = NULL;
+	kfree(sbi->slowops);
+	sbi->slowops = NULL;
+}
+
+void xcfs_init_debugfs(void)
+{
+	xcfs_debugfs_root = debugfs_create_dir(XCFS_NAME, NULL);
+}
+
+void xcfs_destroy_debugfs(void)
+{
+	debugfs_remove_recursive(xcfs_debugfs_root);
+	xcfs_debugfs_root = NULL;
+}
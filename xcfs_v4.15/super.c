@@ -10,58 +10,314 @@
  */
 
 #include "xcfs.h"
+#include "xcfs_trace.h"
+#include <linux/module.h>
+#include <linux/parser.h>
+#include <linux/backing-dev.h>
 
 /*
  * The inode cache is used with alloc_inode for both our inode info and the
  * vfs inode.
  */
 static struct kmem_cache *xcfs_inode_cachep;
-static int xcfs_show_option(struct seq_file *m, struct dentry *root);
 
 /* final actions when unmounting a file system */
 static void xcfs_put_super(struct super_block *sb)
 {
 	struct xcfs_sb_info *spd;
 	struct super_block *s;
-  printk(KERN_INFO "xcfs_put_super");
+
+	trace_xcfs_put_super(sb, sb->s_flags, 0);
 	spd = XCFS_SB(sb);
 	if (!spd)
 		return;
+	/* queued statfs refreshes and prefetches use the lower mount */
+	destroy_workqueue(spd->wq);
+	dput(spd->lower_root);
 
 	/* decrement lower super references */
 	s = xcfs_lower_super(sb);
 	xcfs_set_lower_super(sb, NULL);
 	atomic_dec(&s->s_active);
+	mntput(spd->lower_mnt);
+	spd->lower_mnt = NULL;
+	put_cred(spd->cred);
+	xcfs_destroy_inode_hash(sb);
+	xcfs_stats_destroy_sb(sb);
 
 	kfree(spd);
 	sb->s_fs_info = NULL;
 }
 
-static int xcfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+/*
+ * statfs results are cached per superblock for statfs_ttl milliseconds.
+ * Past that, callers still get the cached copy and a refresh is queued,
+ * so frequent df/statfs callers never wait on the lower superblock.
+ * Only the first call on a mount goes to the lower filesystem directly.
+ * The module parameter is the default for the statfs_ttl= mount option.
+ */
+static unsigned int xcfs_statfs_ttl = 1000;
+module_param_named(statfs_ttl, xcfs_statfs_ttl, uint, 0644);
+MODULE_PARM_DESC(statfs_ttl,
+		 "Default milliseconds statfs results are cached (0: off)");
+
+static int xcfs_statfs_lower(struct xcfs_sb_info *sbi, struct kstatfs *buf)
 {
+	/*
+	 * Ask about the directory we are mounted on, not the lower mount's
+	 * root: btrfs subvolumes and XFS project quotas answer per tree.
+	 */
+	struct path lower_root = {
+		.mnt = sbi->lower_mnt,
+		.dentry = sbi->lower_root,
+	};
 	int err;
-	struct path lower_path;
 
-  printk(KERN_INFO "xcfs_statfs");
-	xcfs_get_lower_path(dentry, &lower_path);
-	err = vfs_statfs(&lower_path, buf);
-	xcfs_put_lower_path(dentry, &lower_path);
+	err = vfs_statfs(&lower_root, buf);
+	if (err)
+		return err;
 
 	/* set return buf to our f/s to avoid confusing user-level utils */
 	buf->f_type = XCFS_SUPER_MAGIC;
+	return 0;
+}
+
+/* refresh the cached copy from the lower file system */
+static int xcfs_statfs_refresh(struct xcfs_sb_info *sbi, struct kstatfs *buf)
+{
+	int err;
+
+	err = xcfs_statfs_lower(sbi, buf);
+	if (err)
+		return err;
+
+	write_seqlock(&sbi->statfs_lock);
+	sbi->statfs = *buf;
+	sbi->statfs_time = jiffies;
+	sbi->statfs_valid = true;
+	write_sequnlock(&sbi->statfs_lock);
+	return 0;
+}
+
+static void xcfs_statfs_worker(struct work_struct *work)
+{
+	struct xcfs_sb_info *sbi =
+		container_of(work, struct xcfs_sb_info, statfs_work);
+	struct kstatfs buf;
+
+	xcfs_statfs_refresh(sbi, &buf);
+}
 
+void xcfs_init_statfs(struct super_block *sb)
+{
+	seqlock_init(&XCFS_SB(sb)->statfs_lock);
+	INIT_WORK(&XCFS_SB(sb)->statfs_work, xcfs_statfs_worker);
+}
+
+static int xcfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct xcfs_sb_info *sbi = XCFS_SB(dentry->d_sb);
+	unsigned long ttl = msecs_to_jiffies(READ_ONCE(sbi->opts.statfs_ttl));
+	unsigned long stamp;
+	unsigned int seq;
+	bool valid;
+	int err;
+
+	if (!ttl) {
+		err = xcfs_statfs_lower(sbi, buf);
+		goto out_lower;
+	}
+
+	do {
+		seq = read_seqbegin(&sbi->statfs_lock);
+		valid = sbi->statfs_valid;
+		stamp = sbi->statfs_time;
+		*buf = sbi->statfs;
+	} while (read_seqretry(&sbi->statfs_lock, seq));
+
+	if (!valid) {
+		err = xcfs_statfs_refresh(sbi, buf);
+		goto out_lower;
+	}
+	if (time_after(jiffies, stamp + ttl))
+		queue_work(sbi->wq, &sbi->statfs_work);
+	xcfs_stat_inc(dentry->d_sb, XCFS_STAT_STATFS);
+	trace_xcfs_statfs(dentry->d_sb, true, 0);
+	return 0;
+out_lower:
+	xcfs_stat_inc(dentry->d_sb, XCFS_STAT_STATFS);
+	xcfs_stat_inc(dentry->d_sb, XCFS_STAT_STATFS_LOWER);
+	trace_xcfs_statfs(dentry->d_sb, false, err);
 	return err;
 }
 
+/*
+ * Mount options.  Remount can change all of them on a busy mount; they
+ * apply from the next operation on, except ra=, which open files only
+ * pick up when they are opened again.
+ *
+ *	cipher=NAME	implementation from /sys/fs/xcfs/cipher/available,
+ *			default: whichever is selected there
+ *	cache=double	keep plaintext pages above and ciphertext below
+ *	cache=plain	drop lower pages once read or synced
+ *	cache=cipher	drop upper pages after each read(2) or write(2)
+ *	write=through	write(2) encrypts into the lower file at once
+ *	write=back	write(2) only dirties the page where it can, and
+ *			writepage encrypts it later
+ *	ra=KB		readahead, default: the lower file system's
+ *	workers=N	concurrent statfs refreshes and prefetch batches
+ *	stats, nostats	update the debugfs counters and histograms or not
+ *	statfs_ttl=MS	see xcfs_statfs()
+ */
+enum {
+	Opt_cipher, Opt_cache, Opt_write, Opt_ra, Opt_workers,
+	Opt_stats, Opt_nostats, Opt_statfs_ttl, Opt_err
+};
+
+static const match_table_t xcfs_tokens = {
+	{Opt_cipher,		"cipher=%s"},
+	{Opt_cache,		"cache=%s"},
+	{Opt_write,		"write=%s"},
+	{Opt_ra,		"ra=%u"},
+	{Opt_workers,		"workers=%u"},
+	{Opt_stats,		"stats"},
+	{Opt_nostats,		"nostats"},
+	{Opt_statfs_ttl,	"statfs_ttl=%u"},
+	{Opt_err,		NULL}
+};
+
+static const char *const xcfs_cache_names[] = {
+	[XCFS_CACHE_DOUBLE]	= "double",
+	[XCFS_CACHE_PLAIN]	= "plain",
+	[XCFS_CACHE_CIPHER]	= "cipher",
+};
+
+/* indexed by xcfs_mount_opts.write_back */
+static const char *const xcfs_write_names[] = { "through", "back" };
+
+void xcfs_default_options(struct super_block *sb,
+			  struct xcfs_mount_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->cache = XCFS_CACHE_DOUBLE;
+	opts->ra_kb = xcfs_lower_super(sb)->s_bdi->ra_pages <<
+		      (PAGE_SHIFT - 10);
+	opts->workers = WQ_DFL_ACTIVE;
+	opts->stats = true;
+	opts->statfs_ttl = READ_ONCE(xcfs_statfs_ttl);
+}
+
+/* index of @arg in @names, or -errno */
+static int xcfs_match_name(substring_t *arg, const char *const *names,
+			   size_t n)
+{
+	char *s = match_strdup(arg);
+	int i;
+
+	if (!s)
+		return -ENOMEM;
+	i = match_string(names, n, s);
+	kfree(s);
+	return i;
+}
+
+/* update @opts from the comma separated @options; 0 or -errno */
+int xcfs_parse_options(char *options, struct xcfs_mount_opts *opts)
+{
+	substring_t args[MAX_OPT_ARGS];
+	const struct xcfs_cipher_impl *impl;
+	char *p, *name;
+	int err, n;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+		err = 0;
+		switch (match_token(p, xcfs_tokens, args)) {
+		case Opt_cipher:
+			name = match_strdup(&args[0]);
+			if (!name)
+				return -ENOMEM;
+			impl = xcfs_cipher_find(name);
+			kfree(name);
+			if (impl)
+				opts->cipher = impl;
+			else
+				err = -EINVAL;
+			break;
+		case Opt_cache:
+			err = xcfs_match_name(&args[0], xcfs_cache_names,
+					      ARRAY_SIZE(xcfs_cache_names));
+			if (err >= 0)
+				opts->cache = err;
+			break;
+		case Opt_write:
+			err = xcfs_match_name(&args[0], xcfs_write_names,
+					      ARRAY_SIZE(xcfs_write_names));
+			if (err >= 0)
+				opts->write_back = err;
+			break;
+		case Opt_ra:
+			err = match_int(&args[0], &n);
+			if (!err)
+				opts->ra_kb = n;
+			break;
+		case Opt_workers:
+			err = match_int(&args[0], &n);
+			if (!err && (n < 1 || n > WQ_MAX_ACTIVE))
+				err = -EINVAL;
+			if (!err)
+				opts->workers = n;
+			break;
+		case Opt_stats:
+			opts->stats = true;
+			break;
+		case Opt_nostats:
+			opts->stats = false;
+			break;
+		case Opt_statfs_ttl:
+			err = match_int(&args[0], &n);
+			if (!err)
+				opts->statfs_ttl = n;
+			break;
+		default:
+			err = -EINVAL;
+		}
+		if (err < 0) {
+			printk(KERN_ERR "xcfs: bad mount option '%s'\n", p);
+			return err;
+		}
+	}
+	return 0;
+}
+
+/* make @opts the options of @sb */
+void xcfs_set_options(struct super_block *sb,
+		      const struct xcfs_mount_opts *opts)
+{
+	struct xcfs_sb_info *sbi = XCFS_SB(sb);
+
+	WRITE_ONCE(sbi->opts.cipher, opts->cipher);
+	WRITE_ONCE(sbi->opts.cache, opts->cache);
+	WRITE_ONCE(sbi->opts.write_back, opts->write_back);
+	WRITE_ONCE(sbi->opts.ra_kb, opts->ra_kb);
+	WRITE_ONCE(sbi->opts.workers, opts->workers);
+	WRITE_ONCE(sbi->opts.stats, opts->stats);
+	WRITE_ONCE(sbi->opts.statfs_ttl, opts->statfs_ttl);
+	/* file_ra_state_init() copies this at open */
+	WRITE_ONCE(sb->s_bdi->ra_pages, opts->ra_kb >> (PAGE_SHIFT - 10));
+	workqueue_set_max_active(sbi->wq, opts->workers);
+}
+
 /*
  * @flags: numeric mount options
- * @options: mount options string
+ * @options: mount options string; options not in it keep their values
  */
 static int xcfs_remount_fs(struct super_block *sb, int *flags, char *options)
 {
+	struct xcfs_mount_opts opts = XCFS_SB(sb)->opts;
 	int err = 0;
 
-  printk(KERN_INFO "xcfs_remount_fs");
 	/*
 	 * The VFS will take care of "ro" and "rw" flags among others.  We
 	 * can safely accept a few flags (RDONLY, MANDLOCK), and honor
@@ -71,11 +327,35 @@ static int xcfs_remount_fs(struct super_block *sb, int *flags, char *options)
 		printk(KERN_ERR
 		       "xcfs: remount flags 0x%x unsupported\n", *flags);
 		err = -EINVAL;
+		goto out;
 	}
 
+	err = xcfs_parse_options(options, &opts);
+	if (!err)
+		xcfs_set_options(sb, &opts);
+out:
+	xcfs_stat_inc(sb, XCFS_STAT_REMOUNT);
+	trace_xcfs_remount_fs(sb, *flags, err);
 	return err;
 }
 
+/* every option, so /proc/mounts shows the mount's full configuration */
+static int xcfs_show_options(struct seq_file *m, struct dentry *root)
+{
+	struct super_block *sb = root->d_sb;
+	struct xcfs_mount_opts *opts = &XCFS_SB(sb)->opts;
+
+	seq_printf(m, ",cipher=%s", xcfs_sb_cipher(sb)->name);
+	seq_printf(m, ",cache=%s", xcfs_cache_names[READ_ONCE(opts->cache)]);
+	seq_printf(m, ",write=%s",
+		   xcfs_write_names[READ_ONCE(opts->write_back)]);
+	seq_printf(m, ",ra=%u", READ_ONCE(opts->ra_kb));
+	seq_printf(m, ",workers=%u", READ_ONCE(opts->workers));
+	seq_puts(m, READ_ONCE(opts->stats) ? ",stats" : ",nostats");
+	seq_printf(m, ",statfs_ttl=%u", READ_ONCE(opts->statfs_ttl));
+	return 0;
+}
+
 /*
  * Called by iput() when the inode reference count reached zero
  * and the inode is not hashed anywhere.  Used to clear anything
@@ -85,9 +365,32 @@ static int xcfs_remount_fs(struct super_block *sb, int *flags, char *options)
 static void xcfs_evict_inode(struct inode *inode)
 {
 	struct inode *lower_inode;
-  printk(KERN_INFO "xcfs_evict_inode");
+	struct file *lower_file;
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_EVICT_INODE);
+	trace_xcfs_evict_inode(inode);
+	/*
+	 * We are evicted on the last iput (generic_delete_inode), so with
+	 * write=back or after mmap writes the cache can still be dirty.
+	 */
+	if (inode->i_nlink)
+		filemap_write_and_wait(&inode->i_data);
 	truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
+	xcfs_unhash_inode(inode);
+	if (S_ISDIR(inode->i_mode))
+		xcfs_dircache_free(inode);
+	xcfs_xattr_cache_free(inode);
+	/* drop the shared lower files; no upper opens are left */
+	lower_file = XCFS_I(inode)->lower_file;
+	if (lower_file) {
+		XCFS_I(inode)->lower_file = NULL;
+		fput(lower_file);
+	}
+	lower_file = XCFS_I(inode)->lower_wfile;
+	if (lower_file) {
+		XCFS_I(inode)->lower_wfile = NULL;
+		fput(lower_file);
+	}
 	/*
 	 * Decrement a reference to a lower_inode, which was incremented
 	 * by our read_inode when it was created initially.
@@ -101,8 +404,9 @@ static struct inode *xcfs_alloc_inode(struct super_block *sb)
 {
 	struct xcfs_inode_info *i;
 
-  printk(KERN_INFO "xcfs_alloc_inode");
 	i = kmem_cache_alloc(xcfs_inode_cachep, GFP_KERNEL);
+	xcfs_stat_inc(sb, XCFS_STAT_ALLOC_INODE);
+	trace_xcfs_alloc_inode(sb, i ? &i->vfs_inode : NULL);
 	if (!i)
 		return NULL;
 
@@ -113,12 +417,27 @@ static struct inode *xcfs_alloc_inode(struct super_block *sb)
 	return &i->vfs_inode;
 }
 
-static void xcfs_destroy_inode(struct inode *inode)
+static void xcfs_i_callback(struct rcu_head *head)
 {
-  printk(KERN_INFO "xcfs_destroy_inode");
+	struct inode *inode = container_of(head, struct inode, i_rcu);
+
+	/* cached symlink body, see xcfs_get_link() */
+	if (S_ISLNK(inode->i_mode))
+		kfree(inode->i_link);
 	kmem_cache_free(xcfs_inode_cachep, XCFS_I(inode));
 }
 
+/*
+ * Freed after a grace period: xcfs_iget may still be looking at this
+ * inode through the lockless inode hash.
+ */
+static void xcfs_destroy_inode(struct inode *inode)
+{
+	xcfs_stat_inc(inode->i_sb, XCFS_STAT_DESTROY_INODE);
+	trace_xcfs_destroy_inode(inode);
+	call_rcu(&inode->i_rcu, xcfs_i_callback);
+}
+
 /* xcfs inode cache constructor */
 static void init_once(void *obj)
 {
@@ -143,6 +462,8 @@ int xcfs_init_inode_cache(void)
 /* xcfs inode cache destructor */
 void xcfs_destroy_inode_cache(void)
 {
+	/* wait for pending xcfs_i_callback()s */
+	rcu_barrier();
 	if (xcfs_inode_cachep)
 		kmem_cache_destroy(xcfs_inode_cachep);
 }
@@ -166,25 +487,12 @@ const struct super_operations xcfs_sops = {
 	.remount_fs	= xcfs_remount_fs,
 	.evict_inode	= xcfs_evict_inode,
 	.umount_begin	= xcfs_umount_begin,
-	/*.show_options	= generic_show_options,*/
-	.show_options	= xcfs_show_option, 
+	.show_options	= xcfs_show_options,
 	.alloc_inode	= xcfs_alloc_inode,
 	.destroy_inode	= xcfs_destroy_inode,
 	.drop_inode	= generic_delete_inode,
 };
 
-static int xcfs_show_option(struct seq_file *m, struct dentry *root)
-{
-    /*if (test_bit(AFS_VNODE_AUTOCELL, &AFS_FS_I(d_inode(root))->flags))*/
-		/*seq_puts(m, "autocell");*/
-    seq_putc(m, ',');
-    seq_escape(m, "wrap", " \t\n\\");
-    /*struct super_block *sb = root->d_sb;*/
-    /*seq_show_option(m, "wrapfs", 0);*/
-    return 0;
-}
-
-
 /* NFS support */
 
 static struct inode *xcfs_nfs_get_inode(struct super_block *sb, u64 ino,
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+
+/*
+ * /sys/fs/xcfs.  The cipher group lists the implementations, shows the
+ * load-time benchmark results and lets the one in use be changed:
+ *
+ *	/sys/fs/xcfs/cipher/available	implementations, one per line
+ *	/sys/fs/xcfs/cipher/bench	"<name> <MB/s>" once bench=1 ran
+ *					(CONFIG_XCFS_CIPHER_BENCH only)
+ *	/sys/fs/xcfs/cipher/selected	current one; write a name to switch
+ *
+ * Mounts with a cipher= option (see super.c) do not follow selected.
+ *
+ * All implementations produce the same bytes, so switching while files
+ * are open is safe.
+ */
+static struct kobject *xcfs_kobj;
+
+static ssize_t available_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; xcfs_cipher_impls[i]; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\n",
+				 xcfs_cipher_impls[i]->name);
+	return len;
+}
+
+#ifdef CONFIG_XCFS_CIPHER_BENCH
+static ssize_t bench_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < XCFS_CIPHER_BENCH_MAX && xcfs_cipher_impls[i]; i++) {
+		if (!xcfs_cipher_bench_mbps[i])
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %lu\n",
+				 xcfs_cipher_impls[i]->name,
+				 xcfs_cipher_bench_mbps[i]);
+	}
+	return len;
+}
+#endif
+
+static ssize_t selected_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s\n", READ_ONCE(xcfs_cipher)->name);
+}
+
+static ssize_t selected_store(struct kobject *kobj,
+			      struct kobj_attribute *attr, const char *buf,
+			      size_t count)
+{
+	const struct xcfs_cipher_impl *impl;
+	char name[32];
+
+	strlcpy(name, buf, sizeof(name));
+	impl = xcfs_cipher_find(strim(name));
+	if (!impl)
+		return -EINVAL;
+	WRITE_ONCE(xcfs_cipher, impl);
+	return count;
+}
+
+static struct kobj_attribute xcfs_attr_available = __ATTR_RO(available);
+#ifdef CONFIG_XCFS_CIPHER_BENCH
+static struct kobj_attribute xcfs_attr_bench = __ATTR_RO(bench);
+#endif
+static struct kobj_attribute xcfs_attr_selected = __ATTR_RW(selected);
+
+static struct attribute *xcfs_cipher_attrs[] = {
+	&xcfs_attr_available.attr,
+#ifdef CONFIG_XCFS_CIPHER_BENCH
+	&xcfs_attr_bench.attr,
+#endif
+	&xcfs_attr_selected.attr,
+	NULL,
+};
+
+static const struct attribute_group xcfs_cipher_group = {
+	.name	= "cipher",
+	.attrs	= xcfs_cipher_attrs,
+};
+
+int xcfs_init_sysfs(void)
+{
+	int err;
+
+	xcfs_kobj = kobject_create_and_add(XCFS_NAME, fs_kobj);
+	if (!xcfs_kobj)
+		return -ENOMEM;
+	err = sysfs_create_group(xcfs_kobj, &xcfs_cipher_group);
+	if (err) {
+		kobject_put(xcfs_kobj);
+		xcfs_kobj = NULL;
+	}
+	return err;
+}
+
+void xcfs_destroy_sysfs(void)
+{
+	if (!xcfs_kobj)
+		return;
+	sysfs_remove_group(xcfs_kobj, &xcfs_cipher_group);
+	kobject_put(xcfs_kobj);
+	xcfs_kobj = NULL;
+}
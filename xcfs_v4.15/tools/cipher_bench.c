@@ -0,0 +1,120 @@
+/*
+ * cipher_bench - throughput of each cipher implementation by buffer size
+ * and alignment.
+ *
+ *	cipher_bench [-m msecs] [-s size,...] [-a offset,...] [-i impl]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cipher.h"
+
+#define MAX_LIST	32
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_list(const char *arg, size_t *list)
+{
+	char *copy = strdup(arg), *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(copy, ",", &save); tok && n < MAX_LIST;
+	     tok = strtok_r(NULL, ",", &save))
+		list[n++] = strtoul(tok, NULL, 0);
+	free(copy);
+	return n;
+}
+
+/* GB/s of encrypt+decrypt pairs over @len bytes at @data for @msecs */
+static double bench(const struct xcfs_cipher_impl *impl, u8 *data,
+		    size_t len, int msecs)
+{
+	double start = now(), elapsed;
+	unsigned long iters = 0, batch = 1 + (1 << 20) / (len + 1);
+	unsigned long i;
+
+	do {
+		for (i = 0; i < batch; i++) {
+			impl->encrypt(data, len);
+			impl->decrypt(data, len);
+		}
+		iters += batch;
+		elapsed = now() - start;
+	} while (elapsed * 1000 < msecs);
+
+	return 2.0 * iters * len / elapsed / 1e9;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: cipher_bench [-m msecs] [-s size,...] [-a offset,...] "
+		"[-i impl]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_LIST], aligns[MAX_LIST], max = 0;
+	int nsizes, naligns, msecs = 200, opt, i, s, a;
+	const struct xcfs_cipher_impl *impl;
+	const char *only = NULL;
+	u8 *mem;
+
+	nsizes = parse_list("64,512,4096,65536,1048576", sizes);
+	naligns = parse_list("0,1,8", aligns);
+	while ((opt = getopt(argc, argv, "m:s:a:i:")) != -1) {
+		switch (opt) {
+		case 'm':
+			msecs = atoi(optarg);
+			break;
+		case 's':
+			nsizes = parse_list(optarg, sizes);
+			break;
+		case 'a':
+			naligns = parse_list(optarg, aligns);
+			break;
+		case 'i':
+			only = optarg;
+			if (!xcfs_cipher_find(only)) {
+				fprintf(stderr, "no implementation %s\n", only);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+
+	for (s = 0; s < nsizes; s++)
+		for (a = 0; a < naligns; a++)
+			if (sizes[s] + aligns[a] > max)
+				max = sizes[s] + aligns[a];
+	if (posix_memalign((void **)&mem, 4096, max + 1))
+		return 1;
+	memset(mem, 0xa5, max + 1);
+
+	printf("%-8s %10s %6s %10s\n", "impl", "size", "align", "GB/s");
+	for (i = 0; (impl = xcfs_cipher_impls[i]); i++) {
+		if (only && strcmp(only, impl->name))
+			continue;
+		for (s = 0; s < nsizes; s++)
+			for (a = 0; a < naligns; a++)
+				printf("%-8s %10zu %6zu %10.2f\n", impl->name,
+				       sizes[s], aligns[a],
+				       bench(impl, mem + aligns[a], sizes[s],
+					     msecs));
+	}
+	free(mem);
+	return 0;
+}
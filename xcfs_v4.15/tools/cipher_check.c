@@ -0,0 +1,78 @@
+/*
+ * cipher_check - check every cipher implementation against the first
+ * (byte at a time) one, for all byte values, lengths and alignments
+ * around word boundaries, and that decrypt undoes encrypt.  Guard bytes
+ * around the buffer catch writes outside it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cipher.h"
+
+#define MAX_LEN		4200
+#define MAX_OFFSET	16
+#define GUARD		16
+#define GUARD_BYTE	0x5a
+
+static u8 src[MAX_LEN];
+static u8 ref[GUARD + MAX_OFFSET + MAX_LEN + GUARD];
+static u8 buf[GUARD + MAX_OFFSET + MAX_LEN + GUARD];
+
+static int failures;
+
+static void fail(const char *impl, const char *what, size_t off, size_t len)
+{
+	if (failures++ < 20)
+		fprintf(stderr, "%s: %s wrong at offset %zu length %zu\n",
+			impl, what, off, len);
+}
+
+static void check_one(const struct xcfs_cipher_impl *impl, size_t off,
+		      size_t len)
+{
+	const struct xcfs_cipher_impl *base = xcfs_cipher_impls[0];
+	u8 *r = ref + GUARD + off, *b = buf + GUARD + off;
+
+	memset(ref, GUARD_BYTE, sizeof(ref));
+	memset(buf, GUARD_BYTE, sizeof(buf));
+	memcpy(r, src, len);
+	memcpy(b, src, len);
+
+	base->encrypt(r, len);
+	impl->encrypt(b, len);
+	if (memcmp(ref, buf, sizeof(buf)))
+		fail(impl->name, "encrypt", off, len);
+
+	base->decrypt(r, len);
+	impl->decrypt(b, len);
+	if (memcmp(ref, buf, sizeof(buf)))
+		fail(impl->name, "decrypt", off, len);
+	if (memcmp(b, src, len))
+		fail(impl->name, "round trip", off, len);
+}
+
+int main(void)
+{
+	const struct xcfs_cipher_impl *impl;
+	size_t i, off, len, runs = 0;
+
+	/* every byte value, including the 0x7f/0x80/0xff carry cases */
+	for (i = 0; i < MAX_LEN; i++)
+		src[i] = i < 512 ? (int)i : rand();
+
+	for (i = 0; (impl = xcfs_cipher_impls[i]); i++) {
+		for (off = 0; off < MAX_OFFSET; off++) {
+			for (len = 0; len <= 80; len++, runs++)
+				check_one(impl, off, len);
+			for (len = 4096 - 8; len <= 4096 + 8; len++, runs++)
+				check_one(impl, off, len);
+			check_one(impl, off, MAX_LEN);
+			runs++;
+		}
+	}
+
+	printf("%zu checks, %d failures\n", runs, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,785 @@
+/*
+ * xcfs_cachesim - replay a recorded xcfs trace (see xcfs_trace_format.h)
+ * through a model of the two page caches and report, per policy, hit
+ * rates, I/O sent to the lower file system and time spent in the
+ * cipher.
+ *
+ * The model: reads go through the upper (plaintext) cache.  A miss
+ * reads ahead a window that doubles while access stays sequential, and
+ * each page brought in is decrypted from the lower (ciphertext) cache,
+ * which reads from the lower file system on a miss.  Consecutive lower
+ * misses are issued as one request of up to batch= pages.  Writes with
+ * write=through encrypt and write to the lower file at once, as
+ * xcfs_write_end() does.  With write=back they only dirty the upper
+ * page, and encryption waits for eviction, fsync or dirty expiry.
+ * cache= chooses which layers keep pages: double (both), plain (upper
+ * only) or cipher (lower only).  Both caches are LRU.
+ *
+ *	xcfs_cachesim [-e ns/byte] [-o ns/page] [-j] [-P policy]... <trace>
+ *
+ * A policy is a comma separated list of key=value overriding the
+ * defaults, e.g. -P cache=plain,upper=64M,ra=64,write=back,batch=32.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xcfs_trace_format.h"
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+#define MAX_POLICIES	16
+/* flush dirty pages older than expire= this often, in trace time */
+#define FLUSH_INTERVAL_NS	(5ULL * 1000000000ULL)
+
+enum cache_mode { CACHE_DOUBLE, CACHE_PLAIN, CACHE_CIPHER };
+
+struct policy {
+	char spec[256];
+	enum cache_mode mode;
+	uint64_t upper_pages;
+	uint64_t lower_pages;
+	unsigned int ra;		/* readahead pages, max window */
+	int write_back;
+	unsigned int batch;		/* pages per lower request */
+	uint64_t expire_ns;		/* dirty page age before writeback */
+};
+
+struct page {
+	uint32_t id;
+	uint64_t index;
+	uint64_t dirtied_ns;		/* 0 if clean */
+	struct page *prev, *next;	/* LRU, most recent at head */
+	struct page *hnext;		/* hash chain */
+	struct page *fprev, *fnext;	/* the file's pages in this cache */
+};
+
+struct cache {
+	uint64_t capacity, count;
+	struct page **buckets;
+	uint64_t nr_buckets;
+	struct page lru;		/* list head */
+	struct page **files;		/* per-id list heads */
+	uint32_t nr_files;
+};
+
+struct file {
+	int64_t size;
+	uint64_t ra_next;		/* index that continues the stream */
+	unsigned int ra_window;
+};
+
+struct result {
+	uint64_t upper_hits, upper_misses;
+	uint64_t lower_hits, lower_misses;
+	uint64_t lower_read_bytes, lower_write_bytes;
+	uint64_t lower_read_reqs, lower_write_reqs;
+	uint64_t decrypted, encrypted;
+	uint64_t rmw_reads;		/* partial page writes that read */
+	uint64_t coalesced;		/* writes to an already dirty page */
+};
+
+struct sim {
+	struct policy *pol;
+	struct cache upper, lower;
+	struct file *files;
+	uint32_t nr_files;
+	uint64_t next_flush_ns;
+	uint64_t run;			/* pending lower read run length */
+	struct result res;
+};
+
+static double ns_per_byte = 0.1;	/* ~10 GB/s, the SWAR cipher */
+static double ns_per_page = 100;
+
+static struct xtr_rec *recs;
+static size_t nr_recs;
+static int64_t *initial_size;		/* by id, from PATH records */
+static uint32_t nr_ids;
+static uint64_t recorded_readpage, recorded_writepage;
+
+static void die(const char *what, const char *arg)
+{
+	fprintf(stderr, "xcfs_cachesim: %s %s: %s\n", what, arg ? arg : "",
+		strerror(errno));
+	exit(1);
+}
+
+static void *xzalloc(size_t size)
+{
+	void *p = calloc(1, size ? size : 1);
+
+	if (!p)
+		die("out of memory", NULL);
+	return p;
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		v <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		v <<= 10;
+		return v >> PAGE_SHIFT;
+	default:
+		return v;		/* pages */
+	}
+}
+
+static void parse_policy(struct policy *pol, const char *spec)
+{
+	char *copy = strdup(spec), *tok, *save, *val;
+
+	*pol = (struct policy) {
+		.mode = CACHE_DOUBLE,
+		.upper_pages = 256 << (20 - PAGE_SHIFT),
+		.lower_pages = 256 << (20 - PAGE_SHIFT),
+		.ra = 32,
+		.batch = 1,
+		.expire_ns = 30ULL * 1000000000ULL,
+	};
+	snprintf(pol->spec, sizeof(pol->spec), "%s", *spec ? spec : "default");
+
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			goto bad;
+		*val++ = '\0';
+		if (!strcmp(tok, "cache")) {
+			if (!strcmp(val, "double"))
+				pol->mode = CACHE_DOUBLE;
+			else if (!strcmp(val, "plain"))
+				pol->mode = CACHE_PLAIN;
+			else if (!strcmp(val, "cipher"))
+				pol->mode = CACHE_CIPHER;
+			else
+				goto bad;
+		} else if (!strcmp(tok, "upper")) {
+			pol->upper_pages = parse_size(val);
+		} else if (!strcmp(tok, "lower")) {
+			pol->lower_pages = parse_size(val);
+		} else if (!strcmp(tok, "ra")) {
+			pol->ra = atoi(val);
+		} else if (!strcmp(tok, "write")) {
+			if (!strcmp(val, "through"))
+				pol->write_back = 0;
+			else if (!strcmp(val, "back"))
+				pol->write_back = 1;
+			else
+				goto bad;
+		} else if (!strcmp(tok, "batch")) {
+			pol->batch = atoi(val);
+		} else if (!strcmp(tok, "expire")) {
+			pol->expire_ns = strtoull(val, NULL, 0) * 1000000000ULL;
+		} else {
+			goto bad;
+		}
+	}
+	if (pol->ra < 1)
+		pol->ra = 1;
+	if (pol->batch < 1)
+		pol->batch = 1;
+	/*
+	 * cache=plain's lower cache holds pages only while in use;
+	 * cache=cipher's upper one also keeps readahead, see upper_release()
+	 */
+	if (pol->mode == CACHE_PLAIN)
+		pol->lower_pages = 0;
+	free(copy);
+	return;
+bad:
+	fprintf(stderr, "xcfs_cachesim: bad policy %s\n", spec);
+	exit(1);
+}
+
+/* cache */
+
+static void cache_init(struct cache *c, uint64_t capacity)
+{
+	c->capacity = capacity;
+	c->nr_buckets = 1024;
+	c->buckets = xzalloc(c->nr_buckets * sizeof(*c->buckets));
+	c->lru.prev = c->lru.next = &c->lru;
+}
+
+static uint64_t page_hash(uint32_t id, uint64_t index)
+{
+	return (index * 0x9e3779b97f4a7c15ULL) ^ (id * 0xc2b2ae3d27d4eb4fULL);
+}
+
+static struct page **cache_slot(struct cache *c, uint32_t id, uint64_t index)
+{
+	struct page **pp = &c->buckets[page_hash(id, index) &
+					(c->nr_buckets - 1)];
+
+	while (*pp && ((*pp)->id != id || (*pp)->index != index))
+		pp = &(*pp)->hnext;
+	return pp;
+}
+
+static void cache_rehash(struct cache *c)
+{
+	struct page **old = c->buckets, *p, *next, **slot;
+	uint64_t i, old_nr = c->nr_buckets;
+
+	c->nr_buckets *= 2;
+	c->buckets = xzalloc(c->nr_buckets * sizeof(*c->buckets));
+	for (i = 0; i < old_nr; i++) {
+		for (p = old[i]; p; p = next) {
+			next = p->hnext;
+			slot = &c->buckets[page_hash(p->id, p->index) &
+					   (c->nr_buckets - 1)];
+			p->hnext = *slot;
+			*slot = p;
+		}
+	}
+	free(old);
+}
+
+static struct page *cache_find(struct cache *c, uint32_t id, uint64_t index)
+{
+	return *cache_slot(c, id, index);
+}
+
+static void lru_unlink(struct page *p)
+{
+	p->prev->next = p->next;
+	p->next->prev = p->prev;
+}
+
+static void lru_add(struct cache *c, struct page *p)
+{
+	p->next = c->lru.next;
+	p->prev = &c->lru;
+	c->lru.next->prev = p;
+	c->lru.next = p;
+}
+
+static void cache_touch(struct cache *c, struct page *p)
+{
+	lru_unlink(p);
+	lru_add(c, p);
+}
+
+static void cache_remove(struct cache *c, struct page *p)
+{
+	*cache_slot(c, p->id, p->index) = p->hnext;
+	lru_unlink(p);
+	if (p->fprev)
+		p->fprev->fnext = p->fnext;
+	else
+		c->files[p->id] = p->fnext;
+	if (p->fnext)
+		p->fnext->fprev = p->fprev;
+	c->count--;
+	free(p);
+}
+
+static struct page *cache_insert(struct cache *c, uint32_t id, uint64_t index)
+{
+	struct page *p = xzalloc(sizeof(*p)), **slot;
+
+	if (c->count >= c->nr_buckets)
+		cache_rehash(c);
+	if (id >= c->nr_files) {
+		c->files = realloc(c->files, (id + 1) * sizeof(*c->files));
+		if (!c->files)
+			die("out of memory", NULL);
+		memset(c->files + c->nr_files, 0,
+		       (id + 1 - c->nr_files) * sizeof(*c->files));
+		c->nr_files = id + 1;
+	}
+	p->id = id;
+	p->index = index;
+	slot = cache_slot(c, id, index);
+	p->hnext = *slot;
+	*slot = p;
+	p->fnext = c->files[id];
+	if (p->fnext)
+		p->fnext->fprev = p;
+	c->files[id] = p;
+	lru_add(c, p);
+	c->count++;
+	return p;
+}
+
+/* simulation */
+
+static struct file *sim_file(struct sim *s, uint32_t id)
+{
+	uint32_t i;
+
+	if (id >= s->nr_files) {
+		s->files = realloc(s->files, (id + 1) * sizeof(*s->files));
+		if (!s->files)
+			die("out of memory", NULL);
+		for (i = s->nr_files; i <= id; i++) {
+			memset(&s->files[i], 0, sizeof(s->files[i]));
+			s->files[i].size = i < nr_ids ? initial_size[i] : 0;
+		}
+		s->nr_files = id + 1;
+	}
+	return &s->files[id];
+}
+
+/* end a run of consecutive lower read misses */
+static void lower_read_flush(struct sim *s)
+{
+	if (s->run)
+		s->res.lower_read_reqs +=
+			(s->run + s->pol->batch - 1) / s->pol->batch;
+	s->run = 0;
+}
+
+/* the ciphertext for a page is needed: from the lower cache or below */
+static void lower_read(struct sim *s, uint32_t id, uint64_t index)
+{
+	struct page *p = cache_find(&s->lower, id, index);
+
+	if (p) {
+		s->res.lower_hits++;
+		cache_touch(&s->lower, p);
+		lower_read_flush(s);
+		return;
+	}
+	s->res.lower_misses++;
+	s->res.lower_read_bytes += PAGE_SIZE;
+	s->run++;
+	if (s->pol->lower_pages) {
+		while (s->lower.count >= s->pol->lower_pages)
+			cache_remove(&s->lower, s->lower.lru.prev);
+		cache_insert(&s->lower, id, index);
+	}
+}
+
+/* ciphertext written to the lower file; it stays in the lower cache */
+static void lower_write(struct sim *s, uint32_t id, uint64_t index,
+			uint64_t bytes)
+{
+	struct page *p = cache_find(&s->lower, id, index);
+
+	s->res.encrypted++;
+	s->res.lower_write_bytes += bytes;
+	if (p) {
+		cache_touch(&s->lower, p);
+	} else if (s->pol->lower_pages) {
+		while (s->lower.count >= s->pol->lower_pages)
+			cache_remove(&s->lower, s->lower.lru.prev);
+		cache_insert(&s->lower, id, index);
+	}
+}
+
+static void upper_evict(struct sim *s)
+{
+	struct page *p = s->upper.lru.prev;
+
+	if (p->dirtied_ns) {
+		lower_write(s, p->id, p->index, PAGE_SIZE);
+		s->res.lower_write_reqs++;
+	}
+	cache_remove(&s->upper, p);
+}
+
+/* bring a page into the upper cache, decrypting it */
+static struct page *upper_fill(struct sim *s, uint32_t id, uint64_t index)
+{
+	lower_read(s, id, index);
+	s->res.decrypted++;
+	while (s->upper.count && s->upper.count >= s->pol->upper_pages)
+		upper_evict(s);
+	return cache_insert(&s->upper, id, index);
+}
+
+/*
+ * cache=cipher drops an upper page once it has been read or written,
+ * like xcfs_cache_drop_plain().  Readahead pages not read yet stay.
+ */
+static void upper_release(struct sim *s, struct page *p)
+{
+	if (s->pol->mode == CACHE_CIPHER) {
+		if (p->dirtied_ns) {
+			lower_write(s, p->id, p->index, PAGE_SIZE);
+			s->res.lower_write_reqs++;
+		}
+		cache_remove(&s->upper, p);
+	}
+}
+
+static void sim_read(struct sim *s, const struct xtr_rec *rec)
+{
+	struct file *f = sim_file(s, rec->id);
+	uint64_t first, last, index, i, end_index;
+	struct page *p;
+	unsigned int window;
+	int64_t len = rec->ret > 0 ? rec->ret : 0;
+
+	if (!len)
+		return;
+	first = rec->pos >> PAGE_SHIFT;
+	last = (rec->pos + len - 1) >> PAGE_SHIFT;
+	end_index = f->size > 0 ? (f->size - 1) >> PAGE_SHIFT : 0;
+
+	for (index = first; index <= last; index++) {
+		p = cache_find(&s->upper, rec->id, index);
+		if (p) {
+			s->res.upper_hits++;
+			cache_touch(&s->upper, p);
+			continue;
+		}
+		s->res.upper_misses++;
+
+		/* sequential: grow the window, otherwise start over */
+		if (index == f->ra_next && f->ra_window)
+			window = f->ra_window * 2;
+		else
+			window = 4;
+		if (window > s->pol->ra)
+			window = s->pol->ra;
+		f->ra_window = window;
+		f->ra_next = index + window;
+
+		for (i = index; i < index + window; i++) {
+			if (i > end_index && i > last)
+				break;
+			if (cache_find(&s->upper, rec->id, i)) {
+				lower_read_flush(s);
+				continue;
+			}
+			upper_fill(s, rec->id, i);
+		}
+		lower_read_flush(s);
+	}
+	/* the read is done: only now is the range returned dropped */
+	for (index = first; index <= last; index++) {
+		p = cache_find(&s->upper, rec->id, index);
+		if (p)
+			upper_release(s, p);
+	}
+}
+
+static void sim_write(struct sim *s, const struct xtr_rec *rec,
+		      uint64_t now_ns)
+{
+	struct file *f = sim_file(s, rec->id);
+	int64_t len = rec->ret > 0 ? rec->ret : 0, end = rec->pos + len;
+	uint64_t index, first, last, from, to;
+	struct page *p;
+
+	if (!len)
+		return;
+	first = rec->pos >> PAGE_SHIFT;
+	last = (end - 1) >> PAGE_SHIFT;
+
+	for (index = first; index <= last; index++) {
+		from = index == first ? rec->pos & (PAGE_SIZE - 1) : 0;
+		to = index == last ? ((end - 1) & (PAGE_SIZE - 1)) + 1 :
+			PAGE_SIZE;
+		p = cache_find(&s->upper, rec->id, index);
+		if (p) {
+			s->res.upper_hits++;
+			cache_touch(&s->upper, p);
+		} else if ((from || to < PAGE_SIZE) &&
+			   (int64_t)(index << PAGE_SHIFT) < f->size) {
+			/* partial write of an existing page reads it first */
+			s->res.upper_misses++;
+			s->res.rmw_reads++;
+			p = upper_fill(s, rec->id, index);
+			lower_read_flush(s);
+		} else {
+			while (s->upper.count &&
+			       s->upper.count >= s->pol->upper_pages)
+				upper_evict(s);
+			p = cache_insert(&s->upper, rec->id, index);
+		}
+
+		if (s->pol->write_back) {
+			if (p->dirtied_ns)
+				s->res.coalesced++;
+			else
+				p->dirtied_ns = now_ns ? now_ns : 1;
+		} else {
+			lower_write(s, rec->id, index, to - from);
+			s->res.lower_write_reqs++;
+		}
+		upper_release(s, p);
+	}
+	if (end > f->size)
+		f->size = end;
+}
+
+/* write back @id's dirty pages, or every page dirty since @older_than */
+static void sim_flush(struct sim *s, int64_t id, uint64_t older_than)
+{
+	struct page *p;
+	uint64_t last_index = UINT64_MAX;
+	uint32_t i, run = 0;
+
+	for (i = 0; i < s->upper.nr_files; i++) {
+		if (id >= 0 && i != id)
+			continue;
+		/* the per-file list is newest first, which is good enough */
+		for (p = s->upper.files[i]; p; p = p->fnext) {
+			if (!p->dirtied_ns || p->dirtied_ns > older_than)
+				continue;
+			lower_write(s, p->id, p->index, PAGE_SIZE);
+			if (run && p->index + 1 == last_index &&
+			    run < s->pol->batch) {
+				run++;
+			} else {
+				s->res.lower_write_reqs++;
+				run = 1;
+			}
+			last_index = p->index;
+			p->dirtied_ns = 0;
+		}
+		run = 0;
+	}
+}
+
+static void sim_drop(struct sim *s, uint32_t id, int64_t size)
+{
+	struct cache *caches[] = { &s->upper, &s->lower };
+	uint64_t keep = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	struct page *p, *next;
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		if (id >= caches[c]->nr_files)
+			continue;
+		for (p = caches[c]->files[id]; p; p = next) {
+			next = p->fnext;
+			if (p->index >= keep)
+				cache_remove(caches[c], p);
+		}
+	}
+	sim_file(s, id)->size = size;
+}
+
+static void simulate(struct sim *s)
+{
+	const struct xtr_rec *rec;
+	size_t i;
+
+	cache_init(&s->upper, s->pol->upper_pages);
+	cache_init(&s->lower, s->pol->lower_pages);
+	s->next_flush_ns = FLUSH_INTERVAL_NS;
+
+	for (i = 0; i < nr_recs; i++) {
+		rec = &recs[i];
+		if (s->pol->write_back && rec->time_ns >= s->next_flush_ns) {
+			if (rec->time_ns > s->pol->expire_ns)
+				sim_flush(s, -1,
+					  rec->time_ns - s->pol->expire_ns);
+			s->next_flush_ns = rec->time_ns + FLUSH_INTERVAL_NS;
+		}
+		switch (rec->op) {
+		case XTR_OP_READ:
+			sim_read(s, rec);
+			break;
+		case XTR_OP_WRITE:
+			sim_write(s, rec, rec->time_ns);
+			break;
+		case XTR_OP_FSYNC:
+			sim_flush(s, rec->id, UINT64_MAX);
+			break;
+		case XTR_OP_SETATTR:
+			if ((rec->flags & XTR_F_SIZE) && !rec->ret)
+				sim_drop(s, rec->id, rec->pos);
+			break;
+		case XTR_OP_UNLINK:
+			if (!rec->ret)
+				sim_drop(s, rec->id, 0);
+			break;
+		default:
+			break;
+		}
+	}
+	/* whatever is still dirty is written back eventually */
+	sim_flush(s, -1, UINT64_MAX);
+}
+
+static void load(const char *name)
+{
+	struct xtr_header hdr;
+	struct xtr_rec rec;
+	char path[4096 + 8];
+	size_t alloc = 0;
+	FILE *f;
+	int ret;
+
+	f = fopen(name, "r");
+	if (!f)
+		die("open", name);
+	if (xtr_read_header(f, &hdr)) {
+		errno = EINVAL;
+		die("not an xcfs trace:", name);
+	}
+	while ((ret = xtr_read(f, &rec, path, sizeof(path))) > 0) {
+		if (rec.op == XTR_OP_PATH) {
+			if (rec.id >= nr_ids) {
+				initial_size = realloc(initial_size,
+					(rec.id + 1) * sizeof(*initial_size));
+				if (!initial_size)
+					die("out of memory", NULL);
+				memset(initial_size + nr_ids, 0,
+				       (rec.id + 1 - nr_ids) *
+				       sizeof(*initial_size));
+				nr_ids = rec.id + 1;
+			}
+			initial_size[rec.id] = rec.pos;
+			continue;
+		}
+		if (rec.op == XTR_OP_READPAGE)
+			recorded_readpage++;
+		if (rec.op == XTR_OP_WRITEPAGE)
+			recorded_writepage++;
+		if (nr_recs == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			recs = realloc(recs, alloc * sizeof(*recs));
+			if (!recs)
+				die("out of memory", NULL);
+		}
+		recs[nr_recs++] = rec;
+	}
+	if (ret < 0) {
+		errno = EINVAL;
+		die("bad record in", name);
+	}
+	fclose(f);
+}
+
+static double pct(uint64_t hits, uint64_t misses)
+{
+	return hits + misses ? 100.0 * hits / (hits + misses) : 0;
+}
+
+static double cipher_ms(const struct result *r)
+{
+	return (r->decrypted + r->encrypted) *
+		(PAGE_SIZE * ns_per_byte + ns_per_page) / 1e6;
+}
+
+static void report(struct sim *sims, int n, int json)
+{
+	const struct result *r;
+	int i;
+
+	if (json) {
+		printf("{\"recorded_readpage\": %llu, "
+		       "\"recorded_writepage\": %llu, \"policies\": [",
+		       (unsigned long long)recorded_readpage,
+		       (unsigned long long)recorded_writepage);
+		for (i = 0; i < n; i++) {
+			r = &sims[i].res;
+			printf("%s\n  {\"policy\": \"%s\", "
+			       "\"upper_hit_pct\": %.2f, \"lower_hit_pct\": %.2f, "
+			       "\"lower_read_bytes\": %llu, "
+			       "\"lower_write_bytes\": %llu, "
+			       "\"lower_read_reqs\": %llu, "
+			       "\"lower_write_reqs\": %llu, "
+			       "\"pages_decrypted\": %llu, "
+			       "\"pages_encrypted\": %llu, \"rmw_reads\": %llu, "
+			       "\"coalesced_writes\": %llu, \"cipher_ms\": %.3f}",
+			       i ? "," : "", sims[i].pol->spec,
+			       pct(r->upper_hits, r->upper_misses),
+			       pct(r->lower_hits, r->lower_misses),
+			       (unsigned long long)r->lower_read_bytes,
+			       (unsigned long long)r->lower_write_bytes,
+			       (unsigned long long)r->lower_read_reqs,
+			       (unsigned long long)r->lower_write_reqs,
+			       (unsigned long long)r->decrypted,
+			       (unsigned long long)r->encrypted,
+			       (unsigned long long)r->rmw_reads,
+			       (unsigned long long)r->coalesced, cipher_ms(r));
+		}
+		printf("\n]}\n");
+		return;
+	}
+
+	printf("recorded: %llu readpage, %llu writepage\n",
+	       (unsigned long long)recorded_readpage,
+	       (unsigned long long)recorded_writepage);
+	for (i = 0; i < n; i++) {
+		r = &sims[i].res;
+		printf("\n%s\n", sims[i].pol->spec);
+		printf("  upper hit %.1f%%  lower hit %.1f%%\n",
+		       pct(r->upper_hits, r->upper_misses),
+		       pct(r->lower_hits, r->lower_misses));
+		printf("  lower read %.2f MiB in %llu requests, "
+		       "write %.2f MiB in %llu requests\n",
+		       r->lower_read_bytes / 1048576.0,
+		       (unsigned long long)r->lower_read_reqs,
+		       r->lower_write_bytes / 1048576.0,
+		       (unsigned long long)r->lower_write_reqs);
+		printf("  decrypted %llu pages, encrypted %llu pages, "
+		       "cipher %.3f ms\n",
+		       (unsigned long long)r->decrypted,
+		       (unsigned long long)r->encrypted, cipher_ms(r));
+		printf("  read-modify-write %llu, coalesced writes %llu\n",
+		       (unsigned long long)r->rmw_reads,
+		       (unsigned long long)r->coalesced);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: xcfs_cachesim [-e ns/byte] [-o ns/page] [-j] "
+		"[-P policy]... <trace>\n"
+		"policy keys: cache=double|plain|cipher upper=SIZE lower=SIZE\n"
+		"             ra=PAGES write=through|back batch=PAGES "
+		"expire=SECS\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct policy policies[MAX_POLICIES];
+	struct sim sims[MAX_POLICIES];
+	int opt, n = 0, json = 0, i;
+
+	while ((opt = getopt(argc, argv, "e:o:jP:")) != -1) {
+		switch (opt) {
+		case 'e':
+			ns_per_byte = atof(optarg);
+			break;
+		case 'o':
+			ns_per_page = atof(optarg);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'P':
+			if (n == MAX_POLICIES)
+				usage();
+			parse_policy(&policies[n++], optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	if (!n)
+		parse_policy(&policies[n++], "");
+
+	load(argv[optind]);
+	memset(sims, 0, sizeof(sims));
+	for (i = 0; i < n; i++) {
+		sims[i].pol = &policies[i];
+		simulate(&sims[i]);
+	}
+	report(sims, n, json);
+	return 0;
+}
@@ -0,0 +1,590 @@
+/*
+ * xcfs_record - record the operations on an xcfs mount into a compact
+ * binary trace (see xcfs_trace_format.h) for xcfs_replay and
+ * xcfs_cachesim.
+ *
+ * It enables the xcfs tracepoints, reads trace_pipe until interrupted
+ * (or for -d seconds) and keeps the events for the given mount.  Inode
+ * numbers are turned into paths: the mount is walked first, and lookups,
+ * creates and renames seen while recording extend the table.  -i parses
+ * a saved trace (the "trace" file's text) instead of tracing live.
+ *
+ *	xcfs_record [-d secs] [-i text trace] [-T tracefs] -o out <mount>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "xcfs_trace_format.h"
+
+/* open addressing maps: inode number -> id and path -> id */
+struct ino_slot {
+	uint64_t ino;		/* 0 = empty */
+	uint32_t id;
+};
+
+struct path_slot {
+	char *path;		/* NULL = empty; owned by paths[] */
+	uint32_t id;
+};
+
+static struct ino_slot *ino_map;
+static size_t ino_size, ino_used;
+static struct path_slot *path_map;
+static size_t path_size, path_used;
+static char **paths;			/* id -> path */
+static uint32_t nr_ids;
+
+static FILE *out;
+static const char *mount_point;
+static unsigned int dev_major, dev_minor;
+static uint64_t start_ns;
+static int have_start;
+static unsigned long nr_records, nr_skipped;
+static volatile sig_atomic_t stop;
+
+static void die(const char *what, const char *arg)
+{
+	fprintf(stderr, "xcfs_record: %s %s: %s\n", what, arg ? arg : "",
+		strerror(errno));
+	exit(1);
+}
+
+static void *xzalloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (!p)
+		die("out of memory", NULL);
+	return p;
+}
+
+static uint64_t hash_str(const char *s)
+{
+	uint64_t h = 1469598103934665603ULL;	/* FNV-1a */
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+	return h;
+}
+
+static uint64_t hash_u64(uint64_t v)
+{
+	return v * 0x9e3779b97f4a7c15ULL;
+}
+
+static void ino_grow(void);
+
+static struct ino_slot *ino_lookup(uint64_t ino)
+{
+	size_t i = hash_u64(ino) & (ino_size - 1);
+
+	while (ino_map[i].ino && ino_map[i].ino != ino)
+		i = (i + 1) & (ino_size - 1);
+	return &ino_map[i];
+}
+
+static void ino_set(uint64_t ino, uint32_t id)
+{
+	struct ino_slot *slot;
+
+	if (!ino)
+		return;
+	if ((ino_used + 1) * 2 > ino_size)
+		ino_grow();
+	slot = ino_lookup(ino);
+	if (!slot->ino) {
+		slot->ino = ino;
+		ino_used++;
+	}
+	slot->id = id;
+}
+
+static void ino_grow(void)
+{
+	struct ino_slot *old = ino_map;
+	size_t i, old_size = ino_size;
+
+	ino_size = ino_size ? ino_size * 2 : 1024;
+	ino_map = xzalloc(ino_size * sizeof(*ino_map));
+	ino_used = 0;
+	for (i = 0; i < old_size; i++)
+		if (old[i].ino)
+			ino_set(old[i].ino, old[i].id);
+	free(old);
+}
+
+static struct path_slot *path_lookup(const char *path)
+{
+	size_t i = hash_str(path) & (path_size - 1);
+
+	while (path_map[i].path && strcmp(path_map[i].path, path))
+		i = (i + 1) & (path_size - 1);
+	return &path_map[i];
+}
+
+static void path_grow(void)
+{
+	struct path_slot *old = path_map, *slot;
+	size_t i, old_size = path_size;
+
+	path_size = path_size ? path_size * 2 : 1024;
+	path_map = xzalloc(path_size * sizeof(*path_map));
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].path)
+			continue;
+		slot = path_lookup(old[i].path);
+		*slot = old[i];
+	}
+	free(old);
+}
+
+static void emit(uint64_t ts_ns, uint32_t id, int op, int flags, int64_t pos,
+		 uint32_t len, int32_t ret)
+{
+	struct xtr_rec rec = {
+		.time_ns = ts_ns >= start_ns ? ts_ns - start_ns : 0,
+		.id = id,
+		.op = op,
+		.flags = flags,
+		.pos = pos,
+		.len = len,
+		.ret = ret,
+	};
+
+	if (fwrite(&rec, sizeof(rec), 1, out) != 1)
+		die("write", NULL);
+	nr_records++;
+}
+
+/* the id for @path, emitting its PATH record the first time */
+static uint32_t path_id(const char *path, int flags, int64_t size,
+			uint64_t ts_ns)
+{
+	static const char pad[8];
+	struct path_slot *slot;
+	size_t len;
+
+	if ((path_used + 1) * 2 > path_size)
+		path_grow();
+	slot = path_lookup(path);
+	if (slot->path)
+		return slot->id;
+
+	paths = realloc(paths, (nr_ids + 1) * sizeof(*paths));
+	if (!paths)
+		die("out of memory", NULL);
+	paths[nr_ids] = strdup(path);
+	if (!paths[nr_ids])
+		die("out of memory", NULL);
+	slot->path = paths[nr_ids];
+	slot->id = nr_ids;
+	path_used++;
+
+	len = strlen(path);
+	emit(ts_ns, nr_ids, XTR_OP_PATH, flags, size, len, 0);
+	if (fwrite(path, len, 1, out) != 1 && len)
+		die("write", NULL);
+	if (fwrite(pad, 8 - len % 8, 1, out) != 1)
+		die("write", NULL);
+	return nr_ids++;
+}
+
+/* the id for inode @ino; inodes we never saw a name for get "#<ino>" */
+static uint32_t ino_id(uint64_t ino, uint64_t ts_ns)
+{
+	struct ino_slot *slot;
+	char name[32];
+	uint32_t id;
+
+	if (ino_size) {
+		slot = ino_lookup(ino);
+		if (slot->ino)
+			return slot->id;
+	}
+	snprintf(name, sizeof(name), "#%llu", (unsigned long long)ino);
+	id = path_id(name, 0, 0, ts_ns);
+	ino_set(ino, id);
+	return id;
+}
+
+/* path of @name in directory inode @dir */
+static char *child_path(uint64_t dir, const char *name, uint64_t ts_ns)
+{
+	uint32_t id = ino_id(dir, ts_ns);
+	const char *parent = paths[id];
+	char *path;
+
+	if (asprintf(&path, "%s%s%s", parent, *parent ? "/" : "", name) < 0)
+		die("out of memory", NULL);
+	return path;
+}
+
+static int walk_one(const char *fpath, const struct stat *st, int type,
+		    struct FTW *ftw)
+{
+	const char *rel = fpath + strlen(mount_point);
+	int flags = XTR_F_INITIAL;
+
+	(void)ftw;
+	while (*rel == '/')
+		rel++;
+	if (type == FTW_D)
+		flags |= XTR_F_DIR;
+	ino_set(st->st_ino, path_id(rel, flags,
+				    S_ISREG(st->st_mode) ? st->st_size : 0, 0));
+	return 0;
+}
+
+/* value after the last " @key " in @args */
+static const char *field(const char *args, const char *key)
+{
+	char pat[32];
+	const char *p, *found = NULL;
+
+	snprintf(pat, sizeof(pat), " %s ", key);
+	for (p = args; (p = strstr(p, pat)); p++)
+		found = p;
+	return found ? found + strlen(pat) : NULL;
+}
+
+static long long num(const char *args, const char *key)
+{
+	const char *v = field(args, key);
+
+	return v ? strtoll(v, NULL, 0) : 0;
+}
+
+/* copy of the text between @start and @end */
+static char *slice(const char *start, const char *end)
+{
+	char *s;
+
+	if (!start || !end || end < start)
+		return NULL;
+	s = strndup(start, end - start);
+	if (!s)
+		die("out of memory", NULL);
+	return s;
+}
+
+static void dir_op(int op, uint64_t ts, const char *args)
+{
+	const char *name = field(args, "name");
+	const char *ino_at = field(args, "ino");
+	char *n = slice(name, ino_at ? ino_at - strlen(" ino ") : NULL);
+	char *path;
+	uint64_t ino = num(args, "ino");
+	int err = num(args, "err");
+	uint32_t id;
+
+	if (!n)
+		return;
+	path = child_path(num(args, "dir"), n, ts);
+	id = path_id(path, op == XTR_OP_MKDIR ? XTR_F_DIR : 0, 0, ts);
+	if (!err && ino && op != XTR_OP_UNLINK && op != XTR_OP_RMDIR)
+		ino_set(ino, id);
+	if (op == XTR_OP_LINK)
+		emit(ts, ino_id(ino, ts), op, 0, id, 0, err);
+	else
+		emit(ts, id, op, 0, 0, 0, err);
+	free(path);
+	free(n);
+}
+
+/* "dev M:m <dir>/<name> -> <dir>/<name> err E" */
+static void rename_op(uint64_t ts, const char *args)
+{
+	const char *arrow = strstr(args, " -> "), *err_at = field(args, "err");
+	char *old_name, *new_name, *old_path, *new_path, *end;
+	unsigned long long old_dir, new_dir;
+	uint32_t old_id, new_id;
+	const char *p;
+	size_t i;
+	int err;
+
+	if (!arrow || !err_at)
+		return;
+	/* args start with " dev M:m " */
+	p = strchr(args + strlen(" dev "), ' ');
+	if (!p)
+		return;
+	old_dir = strtoull(p + 1, &end, 10);
+	if (*end != '/')
+		return;
+	old_name = slice(end + 1, arrow);
+	new_dir = strtoull(arrow + strlen(" -> "), &end, 10);
+	if (*end != '/') {
+		free(old_name);
+		return;
+	}
+	new_name = slice(end + 1, err_at - strlen(" err "));
+	err = strtol(err_at, NULL, 0);
+
+	old_path = child_path(old_dir, old_name, ts);
+	new_path = child_path(new_dir, new_name, ts);
+	old_id = path_id(old_path, 0, 0, ts);
+	new_id = path_id(new_path, 0, 0, ts);
+	emit(ts, old_id, XTR_OP_RENAME, 0, new_id, 0, err);
+
+	/*
+	 * Inodes known by the old name are now known by the new one.  Ids
+	 * already handed out below a renamed directory keep their old
+	 * paths; new lookups under it get the new ones.
+	 */
+	if (!err)
+		for (i = 0; i < ino_size; i++)
+			if (ino_map[i].ino && ino_map[i].id == old_id)
+				ino_map[i].id = new_id;
+	free(old_name);
+	free(new_name);
+	free(old_path);
+	free(new_path);
+}
+
+/* events of xcfs_rw_class: "ino I pos P len L ret R" */
+static void rw_op(int op, uint64_t ts, const char *args)
+{
+	emit(ts, ino_id(num(args, "ino"), ts), op, 0, num(args, "pos"),
+	     num(args, "len"), num(args, "ret"));
+}
+
+static void handle_event(const char *event, uint64_t ts, const char *args)
+{
+	static const struct {
+		const char *event;
+		int op;
+	} dir_ops[] = {
+		{ "lookup", XTR_OP_LOOKUP }, { "create", XTR_OP_CREATE },
+		{ "mkdir", XTR_OP_MKDIR }, { "unlink", XTR_OP_UNLINK },
+		{ "rmdir", XTR_OP_RMDIR }, { "symlink", XTR_OP_SYMLINK },
+		{ "mknod", XTR_OP_MKNOD }, { "link", XTR_OP_LINK },
+	};
+	uint64_t ino = num(args, "ino");
+	size_t i;
+
+	for (i = 0; i < sizeof(dir_ops) / sizeof(dir_ops[0]); i++)
+		if (!strcmp(event, dir_ops[i].event)) {
+			dir_op(dir_ops[i].op, ts, args);
+			return;
+		}
+
+	if (!strcmp(event, "rename"))
+		rename_op(ts, args);
+	else if (!strcmp(event, "open"))
+		emit(ts, ino_id(ino, ts), XTR_OP_OPEN, 0, 0,
+		     num(args, "flags"), num(args, "err"));
+	else if (!strcmp(event, "release"))
+		emit(ts, ino_id(ino, ts), XTR_OP_RELEASE, 0, 0, 0,
+		     num(args, "err"));
+	else if (!strcmp(event, "mmap"))
+		emit(ts, ino_id(ino, ts), XTR_OP_MMAP, 0, 0,
+		     num(args, "flags"), num(args, "err"));
+	else if (!strcmp(event, "read_iter"))
+		rw_op(XTR_OP_READ, ts, args);
+	else if (!strcmp(event, "write_iter"))
+		rw_op(XTR_OP_WRITE, ts, args);
+	else if (!strcmp(event, "fsync"))
+		rw_op(XTR_OP_FSYNC, ts, args);
+	else if (!strcmp(event, "readdir"))
+		rw_op(XTR_OP_READDIR, ts, args);
+	else if (!strcmp(event, "getattr"))
+		emit(ts, ino_id(ino, ts), XTR_OP_GETATTR, 0, 0, 0,
+		     num(args, "err"));
+	else if (!strcmp(event, "setattr"))
+		/* ATTR_SIZE */
+		emit(ts, ino_id(ino, ts), XTR_OP_SETATTR,
+		     num(args, "valid") & 0x8 ? XTR_F_SIZE : 0,
+		     num(args, "size"), 0, num(args, "err"));
+	else if (!strcmp(event, "readpage") || !strcmp(event, "writepage"))
+		emit(ts, ino_id(ino, ts),
+		     event[0] == 'r' ? XTR_OP_READPAGE : XTR_OP_WRITEPAGE, 0,
+		     num(args, "index"), 0, num(args, "err"));
+	else
+		nr_skipped++;
+}
+
+/*
+ * "  comm-pid  [cpu] flags  secs.usecs: xcfs_<event>: dev M:m <args>"
+ * The number of flag columns varies between kernels, so anchor on the
+ * event name.
+ */
+static void parse_line(char *line)
+{
+	char *p = strstr(line, ": xcfs_"), *ts_at, *event, *args;
+	unsigned long long secs, usecs = 0;
+	unsigned int major, minor;
+	uint64_t ts;
+	char *end;
+	int digits;
+
+	if (!p)
+		return;
+	for (ts_at = p; ts_at > line && ts_at[-1] != ' '; ts_at--)
+		;
+	secs = strtoull(ts_at, &end, 10);
+	if (*end == '.') {
+		usecs = strtoull(end + 1, &p, 10);
+		/* scale the fraction to nanoseconds */
+		for (digits = p - end - 1; digits < 9; digits++)
+			usecs *= 10;
+	}
+	ts = secs * 1000000000ULL + usecs;
+
+	event = strstr(line, ": xcfs_") + strlen(": xcfs_");
+	args = strchr(event, ':');
+	if (!args)
+		return;
+	*args++ = '\0';
+	args[strcspn(args, "\n")] = '\0';
+	/* field() matches " key ", so keep the leading space */
+	if (sscanf(args, " dev %u:%u", &major, &minor) != 2 ||
+	    major != dev_major || minor != dev_minor)
+		return;
+
+	if (!have_start) {
+		start_ns = ts;
+		have_start = 1;
+	}
+	handle_event(event, ts, args);
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void tracefs_write(const char *tracefs, const char *file,
+			  const char *val)
+{
+	char path[4096];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", tracefs, file);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0 || write(fd, val, strlen(val)) < 0)
+		die("write", path);
+	close(fd);
+}
+
+static const char *find_tracefs(void)
+{
+	static const char *const dirs[] = {
+		"/sys/kernel/tracing", "/sys/kernel/debug/tracing",
+	};
+	char path[4096];
+	size_t i;
+
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(path, sizeof(path), "%s/events/xcfs", dirs[i]);
+		if (!access(path, F_OK))
+			return dirs[i];
+	}
+	errno = ENOENT;
+	die("no xcfs tracepoints; is the module loaded?", NULL);
+	return NULL;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: xcfs_record [-d secs] [-i text trace] "
+		"[-T tracefs] -o out <mount>\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *out_name = NULL, *input = NULL, *tracefs = NULL;
+	struct xtr_header hdr = { .magic = XTR_MAGIC };
+	struct sigaction sa = { .sa_handler = on_signal };
+	char path[4096], *line = NULL;
+	int secs = 0, opt;
+	size_t line_size = 0;
+	struct stat st;
+	FILE *in;
+
+	while ((opt = getopt(argc, argv, "d:i:o:T:")) != -1) {
+		switch (opt) {
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'o':
+			out_name = optarg;
+			break;
+		case 'T':
+			tracefs = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!out_name || optind != argc - 1)
+		usage();
+	mount_point = argv[optind];
+	if (stat(mount_point, &st))
+		die("stat", mount_point);
+	dev_major = major(st.st_dev);
+	dev_minor = minor(st.st_dev);
+
+	out = fopen(out_name, "w");
+	if (!out)
+		die("open", out_name);
+	hdr.version = XTR_VERSION;
+	hdr.rec_size = sizeof(struct xtr_rec);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		die("write", out_name);
+
+	/* name every inode already there */
+	if (nftw(mount_point, walk_one, 64, FTW_PHYS | FTW_MOUNT))
+		die("walk", mount_point);
+
+	if (input) {
+		in = fopen(input, "r");
+		if (!in)
+			die("open", input);
+	} else {
+		if (!tracefs)
+			tracefs = find_tracefs();
+		snprintf(path, sizeof(path), "%s/trace_pipe", tracefs);
+		in = fopen(path, "r");
+		if (!in)
+			die("open", path);
+		/* no SA_RESTART, so a signal interrupts the read */
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGALRM, &sa, NULL);
+		if (secs)
+			alarm(secs);
+		tracefs_write(tracefs, "events/xcfs/enable", "1");
+		fprintf(stderr, "recording %s, ^C to stop\n", mount_point);
+	}
+
+	while (!stop && getline(&line, &line_size, in) > 0)
+		parse_line(line);
+
+	if (!input)
+		tracefs_write(tracefs, "events/xcfs/enable", "0");
+	fclose(in);
+	free(line);
+
+	hdr.start_ns = start_ns;
+	if (fseek(out, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, out) != 1 || fclose(out))
+		die("write", out_name);
+	fprintf(stderr, "%lu records, %u paths, %lu events skipped\n",
+		nr_records, nr_ids, nr_skipped);
+	return 0;
+}
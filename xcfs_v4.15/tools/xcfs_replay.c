@@ -0,0 +1,415 @@
+/*
+ * xcfs_replay - re-issue a trace recorded by xcfs_record against a
+ * directory, usually the root of a test mount, and report throughput
+ * and per-op latency.
+ *
+ * Operations run one at a time in recorded order.  With -s they follow
+ * the recorded timing, sped up by the given factor; -s 0 (the default)
+ * runs them back to back.  -p first creates the files and directories
+ * that existed when recording started, at their recorded sizes.
+ * Page-level events (readpage, writepage) and mmap are not re-issued:
+ * they are what the replayed reads and writes cause.
+ *
+ *	xcfs_replay [-s speed] [-p] [-j] <trace> <dir>
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xcfs_trace_format.h"
+
+#define LAT_BUCKETS	40
+/* largest single read or write we replay */
+#define MAX_IO		(64 << 20)
+
+struct file_state {
+	char *path;		/* NULL if never named, or "#<ino>" */
+	int flags;		/* XTR_F_* of the PATH record */
+	int64_t size;
+	int fd;
+	int refs;		/* replayed opens not yet released */
+};
+
+struct op_stats {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t sum_ns;
+	uint64_t hist[LAT_BUCKETS];
+};
+
+static struct xtr_rec *recs;
+static size_t nr_recs;
+static struct file_state *files;
+static uint32_t nr_files;
+static struct op_stats stats[XTR_OP_NR];
+static uint64_t bytes_read, bytes_written;
+static char *io_buf;
+
+static void die(const char *what, const char *arg)
+{
+	fprintf(stderr, "xcfs_replay: %s %s: %s\n", what, arg ? arg : "",
+		strerror(errno));
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void load(const char *name)
+{
+	struct xtr_header hdr;
+	struct xtr_rec rec;
+	char path[PATH_MAX + 8];
+	size_t alloc = 0;
+	FILE *f;
+	int ret;
+
+	f = fopen(name, "r");
+	if (!f)
+		die("open", name);
+	if (xtr_read_header(f, &hdr)) {
+		errno = EINVAL;
+		die("not an xcfs trace:", name);
+	}
+	while ((ret = xtr_read(f, &rec, path, sizeof(path))) > 0) {
+		if (rec.op == XTR_OP_PATH) {
+			if (rec.id >= nr_files) {
+				files = realloc(files,
+						(rec.id + 1) * sizeof(*files));
+				if (!files)
+					die("out of memory", NULL);
+				memset(files + nr_files, 0,
+				       (rec.id + 1 - nr_files) * sizeof(*files));
+				nr_files = rec.id + 1;
+			}
+			files[rec.id].path = strdup(path);
+			files[rec.id].flags = rec.flags;
+			files[rec.id].size = rec.pos;
+			files[rec.id].fd = -1;
+			continue;
+		}
+		if (nr_recs == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			recs = realloc(recs, alloc * sizeof(*recs));
+			if (!recs)
+				die("out of memory", NULL);
+		}
+		recs[nr_recs++] = rec;
+	}
+	if (ret < 0) {
+		errno = EINVAL;
+		die("bad record in", name);
+	}
+	fclose(f);
+}
+
+/* can the op on @id be replayed at all? */
+static const char *path_of(uint32_t id)
+{
+	if (id >= nr_files || !files[id].path || files[id].path[0] == '#')
+		return NULL;
+	return files[id].path[0] ? files[id].path : ".";
+}
+
+/* recreate what existed when recording started */
+static void prepare(void)
+{
+	const char *path;
+	uint32_t id;
+	int fd;
+
+	for (id = 0; id < nr_files; id++) {
+		if (!(files[id].flags & XTR_F_INITIAL) || !(path = path_of(id)))
+			continue;
+		if (files[id].flags & XTR_F_DIR) {
+			if (mkdir(path, 0755) && errno != EEXIST)
+				die("mkdir", path);
+			continue;
+		}
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0 || ftruncate(fd, files[id].size))
+			die("create", path);
+		close(fd);
+	}
+}
+
+/* the replayed file's descriptor, opening it if the trace never did */
+static int fd_of(uint32_t id, const char *path)
+{
+	struct file_state *f = &files[id];
+
+	if (f->fd < 0) {
+		f->fd = open(path, O_RDWR);
+		if (f->fd < 0)
+			f->fd = open(path, O_RDONLY);
+	}
+	return f->fd;
+}
+
+static int replay_readdir(const char *path)
+{
+	DIR *dir = opendir(path);
+
+	if (!dir)
+		return -1;
+	while (readdir(dir))
+		;
+	return closedir(dir);
+}
+
+/* 1 if done, 0 if skipped, -1 if it failed */
+static int replay_one(const struct xtr_rec *rec)
+{
+	const char *path = path_of(rec->id), *path2;
+	struct file_state *f;
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	if (!path)
+		return 0;
+	f = &files[rec->id];
+
+	switch (rec->op) {
+	case XTR_OP_LOOKUP:
+	case XTR_OP_GETATTR:
+		/* a failed lookup in the trace should fail here too */
+		return lstat(path, &st) && !rec->ret ? -1 : 1;
+	case XTR_OP_CREATE:
+	case XTR_OP_MKNOD:
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			return -1;
+		close(fd);
+		return 1;
+	case XTR_OP_MKDIR:
+		return mkdir(path, 0755) ? -1 : 1;
+	case XTR_OP_SYMLINK:
+		/* the target is not traced */
+		return symlink(".", path) ? -1 : 1;
+	case XTR_OP_UNLINK:
+		return unlink(path) ? -1 : 1;
+	case XTR_OP_RMDIR:
+		return rmdir(path) ? -1 : 1;
+	case XTR_OP_LINK:
+	case XTR_OP_RENAME:
+		path2 = path_of(rec->pos);
+		if (!path2)
+			return 0;
+		if (rec->op == XTR_OP_LINK)
+			return link(path, path2) ? -1 : 1;
+		return rename(path, path2) ? -1 : 1;
+	case XTR_OP_OPEN:
+		if (rec->ret)
+			return 0;
+		if (f->fd >= 0) {
+			f->refs++;
+			return 1;
+		}
+		/* creation was replayed on its own */
+		f->fd = open(path, rec->len & ~(O_CREAT | O_EXCL), 0644);
+		if (f->fd < 0)
+			return -1;
+		f->refs = 1;
+		return 1;
+	case XTR_OP_RELEASE:
+		if (f->fd < 0 || !f->refs)
+			return 0;
+		if (!--f->refs) {
+			close(f->fd);
+			f->fd = -1;
+		}
+		return 1;
+	case XTR_OP_READ:
+	case XTR_OP_WRITE:
+		if (rec->len > MAX_IO || (fd = fd_of(rec->id, path)) < 0)
+			return -1;
+		if (rec->op == XTR_OP_READ) {
+			n = pread(fd, io_buf, rec->len, rec->pos);
+			if (n > 0)
+				bytes_read += n;
+		} else {
+			n = pwrite(fd, io_buf, rec->len, rec->pos);
+			if (n > 0)
+				bytes_written += n;
+		}
+		return n < 0 ? -1 : 1;
+	case XTR_OP_FSYNC:
+		fd = fd_of(rec->id, path);
+		return fd < 0 || fsync(fd) ? -1 : 1;
+	case XTR_OP_SETATTR:
+		if (!(rec->flags & XTR_F_SIZE))
+			return 0;
+		return truncate(path, rec->pos) ? -1 : 1;
+	case XTR_OP_READDIR:
+		/* one full listing per listing that started at the top */
+		if (rec->pos)
+			return 0;
+		return replay_readdir(path) ? -1 : 1;
+	default:
+		return 0;
+	}
+}
+
+static uint64_t percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t want = (uint64_t)(total * pct / 100.0), seen = 0;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return (1ULL << (b + 1)) - 1;
+	}
+	return 1ULL << LAT_BUCKETS;
+}
+
+static void report(uint64_t elapsed, uint64_t max_lag, int json)
+{
+	uint64_t total = 0, errors = 0;
+	double secs = elapsed / 1e9;
+	int op, first = 1;
+
+	for (op = 0; op < XTR_OP_NR; op++) {
+		total += stats[op].count;
+		errors += stats[op].errors;
+	}
+	if (json) {
+		printf("{\"ops\": %llu, \"errors\": %llu, \"seconds\": %.3f, "
+		       "\"ops_per_sec\": %.0f, \"read_mib_per_sec\": %.2f, "
+		       "\"write_mib_per_sec\": %.2f, \"max_lag_ms\": %.3f, "
+		       "\"by_op\": {",
+		       (unsigned long long)total, (unsigned long long)errors,
+		       secs, total / secs, bytes_read / secs / (1 << 20),
+		       bytes_written / secs / (1 << 20), max_lag / 1e6);
+		for (op = 0; op < XTR_OP_NR; op++) {
+			struct op_stats *s = &stats[op];
+
+			if (!s->count)
+				continue;
+			printf("%s\n  \"%s\": {\"count\": %llu, \"errors\": %llu, "
+			       "\"mean_ns\": %llu, \"p99_ns\": %llu}",
+			       first ? "" : ",", xtr_op_names[op],
+			       (unsigned long long)s->count,
+			       (unsigned long long)s->errors,
+			       (unsigned long long)(s->sum_ns / s->count),
+			       (unsigned long long)percentile(s->hist, s->count,
+							      99));
+			first = 0;
+		}
+		printf("\n}}\n");
+		return;
+	}
+
+	printf("%-10s %10s %8s %10s %10s\n", "op", "count", "errors",
+	       "mean_us", "p99_us");
+	for (op = 0; op < XTR_OP_NR; op++) {
+		struct op_stats *s = &stats[op];
+
+		if (!s->count)
+			continue;
+		printf("%-10s %10llu %8llu %10.1f %10.1f\n", xtr_op_names[op],
+		       (unsigned long long)s->count,
+		       (unsigned long long)s->errors,
+		       s->sum_ns / 1e3 / s->count,
+		       percentile(s->hist, s->count, 99) / 1e3);
+	}
+	printf("%llu ops (%llu failed) in %.3fs: %.0f ops/s, "
+	       "read %.2f MiB/s, write %.2f MiB/s, max lag %.3fms\n",
+	       (unsigned long long)total, (unsigned long long)errors, secs,
+	       total / secs, bytes_read / secs / (1 << 20),
+	       bytes_written / secs / (1 << 20), max_lag / 1e6);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: xcfs_replay [-s speed] [-p] [-j] "
+		"<trace> <dir>\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t start, due, t0, ns, max_lag = 0;
+	int opt, do_prepare = 0, json = 0, ret, b;
+	struct timespec ts;
+	double speed = 0;
+	uint32_t max_io = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "s:pj")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'p':
+			do_prepare = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 2 || speed < 0)
+		usage();
+
+	load(argv[optind]);
+	if (chdir(argv[optind + 1]))
+		die("chdir", argv[optind + 1]);
+	if (do_prepare)
+		prepare();
+
+	for (i = 0; i < nr_recs; i++)
+		if ((recs[i].op == XTR_OP_READ || recs[i].op == XTR_OP_WRITE) &&
+		    recs[i].len > max_io && recs[i].len <= MAX_IO)
+			max_io = recs[i].len;
+	io_buf = malloc(max_io + 1);
+	if (!io_buf)
+		die("out of memory", NULL);
+	memset(io_buf, 'x', max_io + 1);
+
+	start = now_ns();
+	for (i = 0; i < nr_recs; i++) {
+		if (speed > 0) {
+			due = start + (uint64_t)(recs[i].time_ns / speed);
+			ns = now_ns();
+			if (ns < due) {
+				ts.tv_sec = due / 1000000000ULL;
+				ts.tv_nsec = due % 1000000000ULL;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+						&ts, NULL);
+			} else if (ns - due > max_lag) {
+				max_lag = ns - due;
+			}
+		}
+		t0 = now_ns();
+		ret = replay_one(&recs[i]);
+		if (!ret)
+			continue;
+		ns = now_ns() - t0;
+		stats[recs[i].op].count++;
+		if (ret < 0)
+			stats[recs[i].op].errors++;
+		stats[recs[i].op].sum_ns += ns;
+		b = ns ? 63 - __builtin_clzll(ns) : 0;
+		stats[recs[i].op].hist[b < LAT_BUCKETS ? b : LAT_BUCKETS - 1]++;
+	}
+	report(now_ns() - start, max_lag, json);
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Binary format of recorded xcfs workloads, written by xcfs_record and
+ * read by xcfs_replay and xcfs_cachesim.
+ *
+ * A trace is a struct xtr_header followed by struct xtr_rec records in
+ * time order.  Files are named by small ids instead of inode numbers, so
+ * a trace can be replayed on another mount.  An XTR_OP_PATH record binds
+ * an id to a path relative to the mount root, and comes before the
+ * first record that uses the id; its path follows it, padded with NULs
+ * to a multiple of 8 bytes.  Fields other than time_ns, id and op mean:
+ *
+ *	PATH		pos size at record start, len path length,
+ *			flags XTR_F_*
+ *	LOOKUP..MKNOD	ret error (0 or -errno)
+ *	LINK, RENAME	pos id of the new name, ret error
+ *	OPEN		len open flags, ret error
+ *	READ, WRITE	pos, len requested, ret bytes or -errno
+ *	FSYNC		pos, len range, ret error
+ *	READDIR		pos directory position, len entries' span
+ *	SETATTR		flags XTR_F_SIZE if pos is the new size
+ *	READPAGE,
+ *	WRITEPAGE	pos page index, ret error
+ *
+ * Everything is little endian, as written by the machine recording it.
+ */
+
+#ifndef _XCFS_TRACE_FORMAT_H_
+#define _XCFS_TRACE_FORMAT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define XTR_MAGIC	"XCFSTRC"	/* 8 bytes with the NUL */
+#define XTR_VERSION	1
+
+#define XTR_OPS(X)			\
+	X(PATH,		"path")		\
+	X(LOOKUP,	"lookup")	\
+	X(CREATE,	"create")	\
+	X(MKDIR,	"mkdir")	\
+	X(UNLINK,	"unlink")	\
+	X(RMDIR,	"rmdir")	\
+	X(SYMLINK,	"symlink")	\
+	X(MKNOD,	"mknod")	\
+	X(LINK,		"link")		\
+	X(RENAME,	"rename")	\
+	X(OPEN,		"open")		\
+	X(RELEASE,	"release")	\
+	X(READ,		"read")		\
+	X(WRITE,	"write")	\
+	X(FSYNC,	"fsync")	\
+	X(GETATTR,	"getattr")	\
+	X(SETATTR,	"setattr")	\
+	X(READDIR,	"readdir")	\
+	X(MMAP,		"mmap")		\
+	X(READPAGE,	"readpage")	\
+	X(WRITEPAGE,	"writepage")
+
+enum xtr_op {
+#define XTR_OP_ENUM(id, name)	XTR_OP_##id,
+	XTR_OPS(XTR_OP_ENUM)
+#undef XTR_OP_ENUM
+	XTR_OP_NR
+};
+
+static const char *const xtr_op_names[XTR_OP_NR] = {
+#define XTR_OP_NAME(id, name)	[XTR_OP_##id] = name,
+	XTR_OPS(XTR_OP_NAME)
+#undef XTR_OP_NAME
+};
+
+/* PATH flags */
+#define XTR_F_DIR	0x1	/* a directory */
+#define XTR_F_INITIAL	0x2	/* existed when recording started */
+/* SETATTR flags */
+#define XTR_F_SIZE	0x1
+
+struct xtr_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;	/* sizeof(struct xtr_rec) */
+	uint64_t start_ns;	/* trace clock at the first record */
+};
+
+struct xtr_rec {
+	uint64_t time_ns;	/* since xtr_header.start_ns */
+	uint32_t id;
+	uint16_t op;		/* enum xtr_op */
+	uint16_t flags;
+	int64_t pos;
+	uint32_t len;
+	int32_t ret;
+};
+
+/* bytes of path data after a PATH record */
+static inline uint32_t xtr_path_bytes(const struct xtr_rec *rec)
+{
+	return (rec->len + 1 + 7) & ~7U;
+}
+
+/* read and check the header; 0 or -1 */
+static inline int xtr_read_header(FILE *f, struct xtr_header *hdr)
+{
+	if (fread(hdr, sizeof(*hdr), 1, f) != 1 ||
+	    memcmp(hdr->magic, XTR_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != XTR_VERSION ||
+	    hdr->rec_size != sizeof(struct xtr_rec))
+		return -1;
+	return 0;
+}
+
+/*
+ * Read the next record, and for PATH records the path into @path, which
+ * holds @size bytes.  1 on success, 0 at the end, -1 on a bad trace.
+ */
+static inline int xtr_read(FILE *f, struct xtr_rec *rec, char *path,
+			   size_t size)
+{
+	uint32_t bytes;
+
+	if (fread(rec, sizeof(*rec), 1, f) != 1)
+		return feof(f) ? 0 : -1;
+	if (rec->op >= XTR_OP_NR)
+		return -1;
+	if (rec->op != XTR_OP_PATH)
+		return 1;
+	bytes = xtr_path_bytes(rec);
+	if (bytes > size || fread(path, bytes, 1, f) != 1)
+		return -1;
+	path[rec->len] = '\0';
+	return 1;
+}
+
+#endif	/* not _XCFS_TRACE_FORMAT_H_ */
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "xcfs.h"
+#include <linux/module.h>
+
+/*
+ * Per-inode cache of extended attributes.  Values up to a small size,
+ * "no such attribute" answers and the listxattr result are remembered on
+ * first access.  The cache is keyed on the lower inode's ctime and
+ * i_version, which every xattr change on the lower side bumps, and is
+ * also dropped whenever xcfs itself changes the inode.
+ */
+static bool xcfs_xattr_cache_enabled = true;
+module_param_named(xattrcache, xcfs_xattr_cache_enabled, bool, 0644);
+MODULE_PARM_DESC(xattrcache, "Cache extended attributes in memory");
+
+/* largest value we keep a copy of */
+#define XCFS_XATTR_MAX_VALUE	256
+/* largest listxattr result we keep a copy of */
+#define XCFS_XATTR_MAX_LIST	1024
+/* names (positive or negative) remembered per inode */
+#define XCFS_XATTR_MAX_ENTRIES	32
+
+struct xcfs_xattr_entry {
+	struct list_head list;
+	ssize_t len;		/* value length, or -ENODATA */
+	char *value;
+	char name[];
+};
+
+struct xcfs_xattr_stamp {
+	struct timespec ctime;
+	u64 version;
+};
+
+struct xcfs_xattr_cache {
+	struct xcfs_xattr_stamp stamp;	/* lower inode stamp when filled */
+	unsigned int nr;
+	struct list_head entries;
+	/* listxattr results, indexed by CAP_SYS_ADMIN (trusted.* names) */
+	char *list[2];
+	ssize_t list_len[2];
+};
+
+static void xcfs_xattr_cache_destroy(struct xcfs_xattr_cache *xc)
+{
+	struct xcfs_xattr_entry *xe, *tmp;
+
+	if (!xc)
+		return;
+	list_for_each_entry_safe(xe, tmp, &xc->entries, list)
+		kfree(xe);
+	kfree(xc->list[0]);
+	kfree(xc->list[1]);
+	kfree(xc);
+}
+
+/*
+ * Sample the lower stamp before reading from the lower inode, so a
+ * change racing with the read makes the result uncacheable.  Inodes
+ * changed within the last second are not cached: a second change in the
+ * same ctime tick would go unnoticed.
+ */
+static bool xcfs_xattr_stamp(struct inode *lower_inode,
+			     struct xcfs_xattr_stamp *st)
+{
+	struct timespec now = current_time(lower_inode);
+
+	spin_lock(&lower_inode->i_lock);
+	st->ctime = lower_inode->i_ctime;
+	st->version = lower_inode->i_version;
+	spin_unlock(&lower_inode->i_lock);
+	return now.tv_sec - st->ctime.tv_sec >= 1;
+}
+
+static bool xcfs_xattr_stamp_equal(const struct xcfs_xattr_stamp *a,
+				   const struct xcfs_xattr_stamp *b)
+{
+	return timespec_equal(&a->ctime, &b->ctime) && a->version == b->version;
+}
+
+/* the inode's cache if it is still valid; called under i_lock */
+static struct xcfs_xattr_cache *xcfs_xattr_cache_valid(struct inode *inode)
+{
+	struct xcfs_xattr_cache *xc = XCFS_I(inode)->xattr_cache;
+	struct inode *lower_inode = xcfs_lower_inode(inode);
+
+	if (xc && timespec_equal(&xc->stamp.ctime, &lower_inode->i_ctime) &&
+	    xc->stamp.version == lower_inode->i_version)
+		return xc;
+	return NULL;
+}
+
+/*
+ * Return the inode's cache for stamp @st, installing @fresh if the old
+ * one is missing or stale.  Called under i_lock; *@old is set to a cache
+ * the caller must destroy after dropping the lock.
+ */
+static struct xcfs_xattr_cache *
+xcfs_xattr_cache_for(struct inode *inode, const struct xcfs_xattr_stamp *st,
+		     struct xcfs_xattr_cache **fresh,
+		     struct xcfs_xattr_cache **old)
+{
+	struct xcfs_xattr_cache *xc = XCFS_I(inode)->xattr_cache;
+	struct xcfs_xattr_stamp now;
+
+	/* only cache what we read if the lower inode is still unchanged */
+	now.ctime = xcfs_lower_inode(inode)->i_ctime;
+	now.version = xcfs_lower_inode(inode)->i_version;
+	if (!xcfs_xattr_stamp_equal(&now, st))
+		return NULL;
+	if (xc && xcfs_xattr_stamp_equal(&xc->stamp, st))
+		return xc;
+	if (!*fresh)
+		return NULL;
+	*old = xc;
+	xc = *fresh;
+	*fresh = NULL;
+	XCFS_I(inode)->xattr_cache = xc;
+	return xc;
+}
+
+static struct xcfs_xattr_cache *
+xcfs_xattr_cache_alloc(struct inode *inode, const struct xcfs_xattr_stamp *st)
+{
+	struct xcfs_xattr_cache *xc = READ_ONCE(XCFS_I(inode)->xattr_cache);
+
+	/* racy peek: most of the time the current cache is reused */
+	if (xc && xcfs_xattr_stamp_equal(&xc->stamp, st))
+		return NULL;
+	xc = kzalloc(sizeof(*xc), GFP_KERNEL);
+	if (!xc)
+		return NULL;
+	xc->stamp = *st;
+	INIT_LIST_HEAD(&xc->entries);
+	return xc;
+}
+
+static ssize_t xcfs_xattr_copy(void *buffer, size_t size, const void *value,
+			       ssize_t len)
+{
+	if (len < 0)
+		return len;
+	if (size) {
+		if (len > size)
+			return -ERANGE;
+		memcpy(buffer, value, len);
+	}
+	return len;
+}
+
+static void xcfs_xattr_cache_add(struct inode *inode,
+				 const struct xcfs_xattr_stamp *st,
+				 const char *name, const void *value,
+				 ssize_t len)
+{
+	struct xcfs_xattr_cache *xc, *fresh, *old = NULL;
+	struct xcfs_xattr_entry *xe, *cur;
+	size_t name_len = strlen(name) + 1;
+
+	xe = kmalloc(sizeof(*xe) + name_len + max_t(ssize_t, len, 0),
+		     GFP_KERNEL);
+	if (!xe)
+		return;
+	memcpy(xe->name, name, name_len);
+	xe->value = xe->name + name_len;
+	xe->len = len;
+	if (len > 0)
+		memcpy(xe->value, value, len);
+	fresh = xcfs_xattr_cache_alloc(inode, st);
+
+	spin_lock(&inode->i_lock);
+	xc = xcfs_xattr_cache_for(inode, st, &fresh, &old);
+	if (!xc || xc->nr >= XCFS_XATTR_MAX_ENTRIES)
+		goto out_unlock;
+	list_for_each_entry(cur, &xc->entries, list)
+		if (!strcmp(cur->name, name))
+			goto out_unlock;
+	list_add(&xe->list, &xc->entries);
+	xc->nr++;
+	xe = NULL;
+out_unlock:
+	spin_unlock(&inode->i_lock);
+	kfree(xe);
+	xcfs_xattr_cache_destroy(fresh);
+	xcfs_xattr_cache_destroy(old);
+}
+
+/* getxattr on @lower_dentry for @inode, answered from the cache if we can */
+ssize_t xcfs_xattr_cache_get(struct inode *inode, struct dentry *lower_dentry,
+			     const char *name, void *buffer, size_t size)
+{
+	struct xcfs_xattr_cache *xc;
+	struct xcfs_xattr_entry *xe;
+	struct xcfs_xattr_stamp st;
+	ssize_t err;
+	char *value;
+
+	if (!READ_ONCE(xcfs_xattr_cache_enabled))
+		return vfs_getxattr(lower_dentry, name, buffer, size);
+
+	spin_lock(&inode->i_lock);
+	xc = xcfs_xattr_cache_valid(inode);
+	if (xc) {
+		list_for_each_entry(xe, &xc->entries, list) {
+			if (strcmp(xe->name, name))
+				continue;
+			err = xcfs_xattr_copy(buffer, size, xe->value,
+					      xe->len);
+			spin_unlock(&inode->i_lock);
+			return err;
+		}
+	}
+	spin_unlock(&inode->i_lock);
+
+	if (!xcfs_xattr_stamp(xcfs_lower_inode(inode), &st))
+		return vfs_getxattr(lower_dentry, name, buffer, size);
+	value = kmalloc(XCFS_XATTR_MAX_VALUE, GFP_KERNEL);
+	if (!value)
+		return vfs_getxattr(lower_dentry, name, buffer, size);
+	err = vfs_getxattr(lower_dentry, name, value, XCFS_XATTR_MAX_VALUE);
+	if (err >= 0 || err == -ENODATA) {
+		xcfs_xattr_cache_add(inode, &st, name, value, err);
+		err = xcfs_xattr_copy(buffer, size, value, err);
+	} else if (err == -ERANGE) {
+		/* too big to cache, let the caller's buffer decide */
+		err = vfs_getxattr(lower_dentry, name, buffer, size);
+	}
+	kfree(value);
+	return err;
+}
+
+/* listxattr on @lower_dentry for @inode, answered from the cache if we can */
+ssize_t xcfs_xattr_cache_list(struct inode *inode, struct dentry *lower_dentry,
+			      char *buffer, size_t size)
+{
+	/* the lower fs only lists trusted.* names to CAP_SYS_ADMIN */
+	int admin = ns_capable_noaudit(&init_user_ns, CAP_SYS_ADMIN);
+	struct xcfs_xattr_cache *xc, *fresh, *old = NULL;
+	struct xcfs_xattr_stamp st;
+	ssize_t err, len;
+	char *list;
+
+	if (!READ_ONCE(xcfs_xattr_cache_enabled))
+		return vfs_listxattr(lower_dentry, buffer, size);
+
+	spin_lock(&inode->i_lock);
+	xc = xcfs_xattr_cache_valid(inode);
+	if (xc && xc->list[admin]) {
+		err = xcfs_xattr_copy(buffer, size, xc->list[admin],
+				      xc->list_len[admin]);
+		spin_unlock(&inode->i_lock);
+		return err;
+	}
+	spin_unlock(&inode->i_lock);
+
+	if (!xcfs_xattr_stamp(xcfs_lower_inode(inode), &st))
+		return vfs_listxattr(lower_dentry, buffer, size);
+	list = kmalloc(XCFS_XATTR_MAX_LIST, GFP_KERNEL);
+	if (!list)
+		return vfs_listxattr(lower_dentry, buffer, size);
+	len = vfs_listxattr(lower_dentry, list, XCFS_XATTR_MAX_LIST);
+	if (len == -ERANGE) {
+		kfree(list);
+		return vfs_listxattr(lower_dentry, buffer, size);
+	}
+	if (len < 0) {
+		kfree(list);
+		return len;
+	}
+
+	err = xcfs_xattr_copy(buffer, size, list, len);
+	fresh = xcfs_xattr_cache_alloc(inode, &st);
+	spin_lock(&inode->i_lock);
+	xc = xcfs_xattr_cache_for(inode, &st, &fresh, &old);
+	if (xc && !xc->list[admin]) {
+		xc->list[admin] = list;
+		xc->list_len[admin] = len;
+		list = NULL;
+	}
+	spin_unlock(&inode->i_lock);
+	kfree(list);
+	xcfs_xattr_cache_destroy(fresh);
+	xcfs_xattr_cache_destroy(old);
+	return err;
+}
+
+/* drop the cached attributes, e.g. after we changed them */
+void xcfs_xattr_cache_invalidate(struct inode *inode)
+{
+	struct xcfs_xattr_cache *xc;
+
+	if (!READ_ONCE(XCFS_I(inode)->xattr_cache))
+		return;
+	spin_lock(&inode->i_lock);
+	xc = XCFS_I(inode)->xattr_cache;
+	XCFS_I(inode)->xattr_cache = NULL;
+	spin_unlock(&inode->i_lock);
+	xcfs_xattr_cache_destroy(xc);
+}
+
+/* called when the inode is evicted */
+void xcfs_xattr_cache_free(struct inode *inode)
+{
+	xcfs_xattr_cache_destroy(XCFS_I(inode)->xattr_cache);
+	XCFS_I(inode)->xattr_cache = NULL;
+}
@@ -25,12 +25,21 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/cred.h>
 #include <linux/xattr.h>
 #include <linux/exportfs.h>
 #include <linux/stacktrace.h>
 #include <linux/writeback.h>
 
 #include <linux/pagemap.h>
+#include <linux/rhashtable.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+#include "cipher.h"
 /* the file system name */
 #define XCFS_NAME "xcfs"
 
@@ -39,8 +48,15 @@
 #define XCFS_SUPER_MAGIC	0xb550ca10
 #define TRUE '1'
 #define FALSE '0'
+#ifdef CONFIG_XCFS_DEBUG
 /* useful for tracking code reachability */
 #define UDBG printk(KERN_DEFAULT "DBG:%s:%s:%d\n", __FILE__, __func__, __LINE__)
+/* checks only debug builds pay for, as VM_BUG_ON() */
+#define XCFS_BUG_ON(cond)	BUG_ON(cond)
+#else
+#define UDBG do { } while (0)
+#define XCFS_BUG_ON(cond)	BUILD_BUG_ON_INVALID(cond)
+#endif
 
 /* operations vectors defined in specific files */
 extern const struct file_operations xcfs_main_fops;
@@ -66,31 +82,318 @@ extern struct dentry *xcfs_lookup(struct inode *dir, struct dentry *dentry,
 				    unsigned int flags);
 extern struct inode *xcfs_iget(struct super_block *sb,
 				 struct inode *lower_inode);
+extern struct file *xcfs_shared_lower_file(struct inode *inode);
+extern struct file *xcfs_writeback_lower_file(struct inode *inode);
+extern struct file *xcfs_private_lower_file(struct file *file);
+extern struct file *xcfs_get_lower_file(struct file *file);
+extern bool xcfs_can_write_back(struct inode *inode);
+extern int xcfs_dircache_iterate(struct file *file, struct dir_context *ctx);
+extern void xcfs_dircache_invalidate(struct inode *dir);
+extern void xcfs_dircache_file_release(struct file *file);
+extern void xcfs_dircache_free(struct inode *dir);
+extern ssize_t xcfs_xattr_cache_get(struct inode *inode,
+				   struct dentry *lower_dentry,
+				   const char *name, void *buffer, size_t size);
+extern ssize_t xcfs_xattr_cache_list(struct inode *inode,
+				    struct dentry *lower_dentry,
+				    char *buffer, size_t size);
+extern void xcfs_xattr_cache_invalidate(struct inode *inode);
+extern void xcfs_xattr_cache_free(struct inode *inode);
+extern void xcfs_prefetch_note_lookup(struct inode *dir);
+extern int xcfs_prefetch_readdir(struct file *file, struct dir_context *ctx,
+		int (*iterate)(struct file *, struct dir_context *));
+extern long xcfs_ioctl(struct file *file, unsigned int cmd, void __user *arg);
+extern void xcfs_sync_attr(struct inode *inode, u32 mask);
+extern void xcfs_sync_stale_attr(struct inode *inode);
+extern int xcfs_init_inode_hash(struct super_block *sb);
+extern void xcfs_destroy_inode_hash(struct super_block *sb);
+extern void xcfs_unhash_inode(struct inode *inode);
+extern void xcfs_init_statfs(struct super_block *sb);
+struct xcfs_mount_opts;
+extern void xcfs_default_options(struct super_block *sb,
+				 struct xcfs_mount_opts *opts);
+extern int xcfs_parse_options(char *options, struct xcfs_mount_opts *opts);
+extern void xcfs_set_options(struct super_block *sb,
+			     const struct xcfs_mount_opts *opts);
+#ifdef CONFIG_XCFS_CIPHER_BENCH
+/* load-time cipher benchmark, see bench.c */
+#define XCFS_CIPHER_BENCH_MAX	8
+extern unsigned long xcfs_cipher_bench_mbps[XCFS_CIPHER_BENCH_MAX];
+extern void xcfs_cipher_select(void);
+#else
+static inline void xcfs_cipher_select(void) { }
+#endif
+extern int xcfs_init_sysfs(void);
+extern void xcfs_destroy_sysfs(void);
+#ifdef CONFIG_XCFS_STATS
+extern void xcfs_init_debugfs(void);
+extern void xcfs_destroy_debugfs(void);
+extern int xcfs_stats_init_sb(struct super_block *sb);
+extern void xcfs_stats_destroy_sb(struct super_block *sb);
+#else
+static inline void xcfs_init_debugfs(void) { }
+static inline void xcfs_destroy_debugfs(void) { }
+static inline int xcfs_stats_init_sb(struct super_block *sb) { return 0; }
+static inline void xcfs_stats_destroy_sb(struct super_block *sb) { }
+#endif
+#ifdef CONFIG_XCFS_DEBUG
+extern void xcfs_inject_init_sb(struct super_block *sb);
+#else
+static inline void xcfs_inject_init_sb(struct super_block *sb) { }
+#endif
 extern int xcfs_interpose(struct dentry *dentry, struct super_block *sb,
 			    struct path *lower_path);
-//void xcfs_encrypt(unsigned char* mem, ssize_t count);
-//void xcfs_encrypt(unsigned char* mem, ssize_t count);
+struct xcfs_dir_cache;
+struct xcfs_xattr_cache;
+
 /* file private data */
 struct xcfs_file_info {
 	struct file *lower_file;
 	const struct vm_operations_struct *lower_vm_ops;
+	struct xcfs_dir_cache *dir_cache;	/* listing snapshot, dirs only */
+	unsigned int dir_index;			/* next entry in it */
 };
 
 /* xcfs inode data in memory */
 struct xcfs_inode_info {
 	struct inode *lower_inode;
+	struct file *lower_file;	/* shared read handle, see file.c */
+	struct file *lower_wfile;	/* writepage's handle, opened lazily */
+	struct xcfs_dir_cache *dir_cache;	/* protected by i_lock */
+	struct xcfs_xattr_cache *xattr_cache;	/* protected by i_lock */
+	unsigned long readdir_time;	/* jiffies of the last listing */
+	atomic_t scan_lookups;		/* lookups soon after a listing */
+	atomic_t attr_stale;		/* XCFS_STALE_* bits */
+	atomic64_t pages_decrypted;	/* for XCFS_IOC_FILESTATS */
+	atomic64_t pages_encrypted;
+	struct rhash_head hash_node;	/* in xcfs_sb_info.inode_hash */
 	struct inode vfs_inode;
 };
 
-/* xcfs dentry data in memory */
+/*
+ * xcfs dentry data in memory.  Every dentry of a mount shares the same
+ * lower vfsmount, so only the lower dentry is kept here and the mount
+ * comes from the superblock.
+ */
 struct xcfs_dentry_info {
-	spinlock_t lock;	/* protects lower_path */
-	struct path lower_path;
+	struct dentry *lower_dentry;
+	struct rcu_head rcu;
+};
+
+/*
+ * Per-mount operation counters, kept per CPU and summed when the debugfs
+ * stats file is read (see stats.c).
+ */
+#define XCFS_STATS(X)						\
+	/* address space operations */				\
+	X(READPAGE,		"readpage")			\
+	X(WRITEPAGE,		"writepage")			\
+	X(WRITE_BEGIN,		"write_begin")			\
+	X(WRITE_END,		"write_end")			\
+	/* file operations */					\
+	X(READ_ITER,		"read_iter")			\
+	X(READ_BYTES,		"read_bytes")			\
+	X(READ_PAGES,		"read_pages")			\
+	X(PAGE_CACHE_HITS,	"page_cache_hits")		\
+	X(PAGE_CACHE_MISSES,	"page_cache_misses")		\
+	X(WRITE_ITER,		"write_iter")			\
+	X(WRITE_BYTES,		"write_bytes")			\
+	X(OPEN,			"open")				\
+	X(RELEASE,		"release")			\
+	X(FLUSH,		"flush")			\
+	X(FSYNC,		"fsync")			\
+	X(FASYNC,		"fasync")			\
+	X(MMAP,			"mmap")				\
+	X(IOCTL,		"ioctl")			\
+	X(READDIR,		"readdir")			\
+	/* inode operations */					\
+	X(LOOKUP,		"lookup")			\
+	X(CREATE,		"create")			\
+	X(LINK,			"link")				\
+	X(UNLINK,		"unlink")			\
+	X(SYMLINK,		"symlink")			\
+	X(MKDIR,		"mkdir")			\
+	X(RMDIR,		"rmdir")			\
+	X(MKNOD,		"mknod")			\
+	X(RENAME,		"rename")			\
+	X(PERMISSION,		"permission")			\
+	X(SETATTR,		"setattr")			\
+	X(GETATTR,		"getattr")			\
+	X(LISTXATTR,		"listxattr")			\
+	/* super operations */					\
+	X(STATFS,		"statfs")			\
+	X(STATFS_LOWER,		"statfs_lower")			\
+	X(REMOUNT,		"remount")			\
+	X(ALLOC_INODE,		"alloc_inode")			\
+	X(EVICT_INODE,		"evict_inode")			\
+	X(DESTROY_INODE,	"destroy_inode")		\
+	/* data transformed and lower I/O issued */		\
+	X(PAGES_DECRYPTED,	"pages_decrypted")		\
+	X(BYTES_DECRYPTED,	"bytes_decrypted")		\
+	X(PAGES_ENCRYPTED,	"pages_encrypted")		\
+	X(BYTES_ENCRYPTED,	"bytes_encrypted")		\
+	X(LOWER_READS,		"lower_reads")			\
+	X(LOWER_READ_BYTES,	"lower_read_bytes")		\
+	X(LOWER_WRITES,		"lower_writes")			\
+	X(LOWER_WRITE_BYTES,	"lower_write_bytes")		\
+	X(INJECTED_NS,		"injected_ns")
+
+enum xcfs_stat {
+#define XCFS_STAT_ENUM(id, name)	XCFS_STAT_##id,
+	XCFS_STATS(XCFS_STAT_ENUM)
+#undef XCFS_STAT_ENUM
+	XCFS_STAT_NR
+};
+
+struct xcfs_stats {
+	u64 count[XCFS_STAT_NR];
+};
+
+/*
+ * Latency histograms: whole operations, and the phases of readpage and
+ * writepage.  Each has log2 buckets of nanoseconds.
+ */
+#define XCFS_LATENCIES(X)					\
+	X(LOOKUP,		"lookup")			\
+	X(OPEN,			"open")				\
+	X(READPAGE,		"readpage")			\
+	X(READPAGE_ALLOC,	"readpage.alloc")		\
+	X(READPAGE_LOCK,	"readpage.lower_lock")		\
+	X(READPAGE_READ,	"readpage.lower_read")		\
+	X(READPAGE_DECRYPT,	"readpage.decrypt")		\
+	X(WRITEPAGE,		"writepage")			\
+	X(WRITEPAGE_FILE,	"writepage.lower_file")		\
+	X(WRITEPAGE_ENCRYPT,	"writepage.encrypt")		\
+	X(WRITEPAGE_LOWER,	"writepage.lower_write")	\
+	X(WRITE_END,		"write_end")			\
+	X(FSYNC,		"fsync")
+
+enum xcfs_lat {
+#define XCFS_LAT_ENUM(id, name)	XCFS_LAT_##id,
+	XCFS_LATENCIES(XCFS_LAT_ENUM)
+#undef XCFS_LAT_ENUM
+	XCFS_LAT_NR
+};
+
+/* bucket i holds [2^i, 2^(i+1)) ns; the last one everything above */
+#define XCFS_LAT_BUCKETS	36
+
+struct xcfs_latency {
+	u64 hist[XCFS_LAT_NR][XCFS_LAT_BUCKETS];
+	u64 sum_ns[XCFS_LAT_NR];
+};
+
+#define XCFS_TIMER_PHASES	4
+
+/* times one operation and, optionally, its phases */
+struct xcfs_op_timer {
+	u64 start;
+	u64 last;		/* end of the previous phase */
+	/* what the operation worked on, for the slow-op recorder */
+	unsigned long ino;
+	loff_t pos;
+	size_t len;
+	unsigned int nr_phases;
+	u8 phase[XCFS_TIMER_PHASES];	/* enum xcfs_lat of each phase */
+	u64 phase_ns[XCFS_TIMER_PHASES];
+};
+
+/* one operation that took longer than the mount's slow threshold */
+struct xcfs_slowop {
+	u64 time_ns;		/* ktime_get_ns() when it finished */
+	u64 total_ns;
+	unsigned long ino;
+	loff_t pos;
+	size_t len;
+	pid_t pid;
+	u8 op;			/* enum xcfs_lat */
+	u8 nr_phases;
+	u8 phase[XCFS_TIMER_PHASES];
+	u64 phase_ns[XCFS_TIMER_PHASES];
+	char comm[TASK_COMM_LEN];
+};
+
+#define XCFS_SLOWOPS		256	/* ring entries per mount */
+
+struct xcfs_slowops {
+	spinlock_t lock;
+	unsigned int next;	/* slot the next record goes to */
+	unsigned int count;	/* valid records, up to XCFS_SLOWOPS */
+	struct xcfs_slowop ops[XCFS_SLOWOPS];
+};
+
+/*
+ * Calls into the lower file system that can be slowed down on purpose,
+ * to emulate slow or remote lower storage (see inject.c).
+ */
+#define XCFS_INJECTS(X)					\
+	X(READ,		"read")				\
+	X(WRITE,	"write")			\
+	X(WRITEPAGE,	"writepage")			\
+	X(LOOKUP,	"lookup")
+
+enum xcfs_inj {
+#define XCFS_INJ_ENUM(id, name)	XCFS_INJ_##id,
+	XCFS_INJECTS(XCFS_INJ_ENUM)
+#undef XCFS_INJ_ENUM
+	XCFS_INJ_NR
+};
+
+struct xcfs_inject {
+	u32 latency_us[XCFS_INJ_NR];	/* fixed delay per call */
+	u32 jitter_us[XCFS_INJ_NR];	/* plus up to this much, uniform */
+	u32 bw_kbps[XCFS_INJ_NR];	/* KiB/s cap, 0: none */
+	spinlock_t lock;		/* protects busy_until */
+	u64 busy_until[XCFS_INJ_NR];	/* ktime ns the emulated link frees */
+};
+
+/* which page caches keep file data, see the cache= mount option */
+enum xcfs_cache_mode {
+	XCFS_CACHE_DOUBLE,	/* plaintext above, ciphertext below */
+	XCFS_CACHE_PLAIN,	/* plaintext only */
+	XCFS_CACHE_CIPHER,	/* ciphertext only */
+};
+
+/*
+ * Mount options (see super.c).  Remount may change any of them while
+ * the mount is in use, so readers use READ_ONCE().
+ */
+struct xcfs_mount_opts {
+	const struct xcfs_cipher_impl *cipher;	/* NULL: xcfs_cipher */
+	unsigned int cache;		/* enum xcfs_cache_mode */
+	bool write_back;		/* else write_end writes the lower file */
+	unsigned int ra_kb;		/* readahead window */
+	unsigned int workers;		/* max_active of the mount's wq */
+	bool stats;			/* update counters and histograms */
+	unsigned int statfs_ttl;	/* ms, see xcfs_statfs() */
 };
 
 /* xcfs super-block data in memory */
 struct xcfs_sb_info {
 	struct super_block *lower_sb;
+	struct vfsmount *lower_mnt;
+	struct dentry *lower_root;	/* what we are mounted on, for statfs */
+	const struct cred *cred;	/* mounter's, for the shared lower files */
+	struct rhashtable inode_hash;	/* upper inodes keyed by lower inode */
+	/* cached lower statfs, see xcfs_statfs() */
+	seqlock_t statfs_lock;
+	struct kstatfs statfs;
+	unsigned long statfs_time;	/* jiffies of the last refresh */
+	bool statfs_valid;
+	struct work_struct statfs_work;
+	struct xcfs_mount_opts opts;
+	/* statfs refresh and readdir prefetch */
+	struct workqueue_struct *wq;
+#ifdef CONFIG_XCFS_STATS
+	struct xcfs_stats __percpu *stats;
+	struct xcfs_latency __percpu *latency;
+	u32 slow_us;			/* record ops slower than this, 0: off */
+	struct xcfs_slowops *slowops;
+	struct dentry *debugfs_dir;	/* xcfs/<major>:<minor> */
+#endif
+#ifdef CONFIG_XCFS_DEBUG
+	struct xcfs_inject inject;
+#endif
 };
 
 /*
@@ -105,19 +408,185 @@ static inline struct xcfs_inode_info *XCFS_I(const struct inode *inode)
 	return container_of(inode, struct xcfs_inode_info, vfs_inode);
 }
 
+/*
+ * Attributes the lower inode may have changed since they were last copied
+ * up.  Hot paths only set these bits; the copy itself is done lazily by
+ * xcfs_sync_attr() from getattr, fsync and writeback.
+ */
+#define XCFS_STALE_ATIME	0x01
+#define XCFS_STALE_TIMES	0x02	/* mtime and ctime */
+#define XCFS_STALE_SIZE		0x04
+
+static inline void xcfs_mark_attr_stale(struct inode *inode, int bits)
+{
+	atomic_t *stale = &XCFS_I(inode)->attr_stale;
+
+	/* test first so repeat callers only read the shared cacheline */
+	if ((atomic_read(stale) & bits) != bits)
+		atomic_or(bits, stale);
+}
+
 /* dentry to private data */
 #define XCFS_D(dent) ((struct xcfs_dentry_info *)(dent)->d_fsdata)
 
 /* superblock to private data */
 #define XCFS_SB(super) ((struct xcfs_sb_info *)(super)->s_fs_info)
 
+#ifdef CONFIG_XCFS_STATS
+static inline bool xcfs_stats_on(struct super_block *sb)
+{
+	return READ_ONCE(XCFS_SB(sb)->opts.stats);
+}
+
+static inline void xcfs_stat_add(struct super_block *sb,
+				 enum xcfs_stat stat, u64 n)
+{
+	if (xcfs_stats_on(sb))
+		this_cpu_add(XCFS_SB(sb)->stats->count[stat], n);
+}
+
+static inline void xcfs_lat_record(struct super_block *sb, enum xcfs_lat lat,
+				   u64 ns)
+{
+	struct xcfs_latency __percpu *l = XCFS_SB(sb)->latency;
+	unsigned int b = ns ? min_t(unsigned int, ilog2(ns),
+					    XCFS_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(l->hist[lat][b]);
+	this_cpu_add(l->sum_ns[lat], ns);
+}
+
+extern void xcfs_slowop_record(struct super_block *sb,
+			       struct xcfs_op_timer *t, enum xcfs_lat lat,
+			       u64 ns);
+
+/* with nostats, don't even read the clock; start 0 marks that */
+static inline void xcfs_timer_start(struct super_block *sb,
+				    struct xcfs_op_timer *t,
+				    unsigned long ino, loff_t pos, size_t len)
+{
+	if (!xcfs_stats_on(sb)) {
+		t->start = 0;
+		return;
+	}
+	t->start = t->last = ktime_get_ns();
+	t->ino = ino;
+	t->pos = pos;
+	t->len = len;
+	t->nr_phases = 0;
+}
+
+/* close the phase that began at the previous start/phase call */
+static inline void xcfs_timer_phase(struct super_block *sb,
+				    struct xcfs_op_timer *t, enum xcfs_lat lat)
+{
+	u64 now;
+
+	if (!t->start || !xcfs_stats_on(sb))
+		return;
+	now = ktime_get_ns();
+	xcfs_lat_record(sb, lat, now - t->last);
+	if (t->nr_phases < XCFS_TIMER_PHASES) {
+		t->phase[t->nr_phases] = lat;
+		t->phase_ns[t->nr_phases++] = now - t->last;
+	}
+	t->last = now;
+}
+
+static inline void xcfs_timer_end(struct super_block *sb,
+				  struct xcfs_op_timer *t, enum xcfs_lat lat)
+{
+	u64 ns;
+	u32 slow_us;
+
+	if (!t->start || !xcfs_stats_on(sb))
+		return;
+	ns = ktime_get_ns() - t->start;
+	slow_us = READ_ONCE(XCFS_SB(sb)->slow_us);
+	xcfs_lat_record(sb, lat, ns);
+	if (unlikely(slow_us && ns >= (u64)slow_us * NSEC_PER_USEC))
+		xcfs_slowop_record(sb, t, lat, ns);
+}
+#else	/* !CONFIG_XCFS_STATS */
+static inline bool xcfs_stats_on(struct super_block *sb) { return false; }
+static inline void xcfs_stat_add(struct super_block *sb,
+				 enum xcfs_stat stat, u64 n) { }
+static inline void xcfs_timer_start(struct super_block *sb,
+				    struct xcfs_op_timer *t,
+				    unsigned long ino, loff_t pos,
+				    size_t len) { }
+static inline void xcfs_timer_phase(struct super_block *sb,
+				    struct xcfs_op_timer *t,
+				    enum xcfs_lat lat) { }
+static inline void xcfs_timer_end(struct super_block *sb,
+				  struct xcfs_op_timer *t,
+				  enum xcfs_lat lat) { }
+#endif	/* !CONFIG_XCFS_STATS */
+
+static inline void xcfs_stat_inc(struct super_block *sb, enum xcfs_stat stat)
+{
+	xcfs_stat_add(sb, stat, 1);
+}
+
+/* the cipher implementation @sb uses, see the cipher= mount option */
+static inline const struct xcfs_cipher_impl *xcfs_sb_cipher(
+	struct super_block *sb)
+{
+	const struct xcfs_cipher_impl *impl =
+		READ_ONCE(XCFS_SB(sb)->opts.cipher);
+
+	return impl ? impl : READ_ONCE(xcfs_cipher);
+}
+
+static inline void xcfs_sb_encrypt(struct super_block *sb,
+				   unsigned char *data, size_t len)
+{
+	xcfs_sb_cipher(sb)->encrypt(data, len);
+}
+
+static inline void xcfs_sb_decrypt(struct super_block *sb,
+				   unsigned char *data, size_t len)
+{
+	xcfs_sb_cipher(sb)->decrypt(data, len);
+}
+
+static inline unsigned int xcfs_cache_mode(struct super_block *sb)
+{
+	return READ_ONCE(XCFS_SB(sb)->opts.cache);
+}
+
+#ifdef CONFIG_XCFS_DEBUG
+extern void __xcfs_inject(struct super_block *sb, enum xcfs_inj op,
+			  size_t bytes);
+
+/* delay a call of kind @op moving @bytes into the lower fs, if configured */
+static inline void xcfs_inject(struct super_block *sb, enum xcfs_inj op,
+			       size_t bytes)
+{
+	struct xcfs_inject *inj = &XCFS_SB(sb)->inject;
+
+	if (unlikely(READ_ONCE(inj->latency_us[op]) |
+		     READ_ONCE(inj->jitter_us[op]) |
+		     READ_ONCE(inj->bw_kbps[op])))
+		__xcfs_inject(sb, op, bytes);
+}
+#else
+static inline void xcfs_inject(struct super_block *sb, enum xcfs_inj op,
+			       size_t bytes) { }
+#endif
+
 /* file to private Data */
 #define XCFS_F(file) ((struct xcfs_file_info *)((file)->private_data))
 
-/* file to lower file */
+/*
+ * file to lower file: the file's own lower file if it has one, else the
+ * inode's shared one.  May be NULL until xcfs_get_lower_file() opens it.
+ */
 static inline struct file *xcfs_lower_file(const struct file *f)
 {
-	return XCFS_F(f)->lower_file;
+	if (XCFS_F(f) && XCFS_F(f)->lower_file)
+		return XCFS_F(f)->lower_file;
+	return READ_ONCE(XCFS_I(file_inode(f))->lower_file);
 }
 
 static inline void xcfs_set_lower_file(struct file *f, struct file *val)
@@ -149,20 +618,35 @@ static inline void xcfs_set_lower_super(struct super_block *sb,
 	XCFS_SB(sb)->lower_sb = val;
 }
 
+/* superblock to lower vfsmount */
+static inline struct vfsmount *xcfs_lower_mnt(const struct super_block *sb)
+{
+	return XCFS_SB(sb)->lower_mnt;
+}
+
 /* path based (dentry/mnt) macros */
 static inline void pathcpy(struct path *dst, const struct path *src)
 {
 	dst->dentry = src->dentry;
 	dst->mnt = src->mnt;
 }
+/*
+ * Returns struct path without taking a reference.  The lower path is
+ * pinned by the upper dentry, so this is safe for as long as the caller
+ * holds the upper dentry; only a lookup or d_release ever changes it.
+ */
+static inline void xcfs_peek_lower_path(const struct dentry *dent,
+					 struct path *lower_path)
+{
+	lower_path->dentry = READ_ONCE(XCFS_D(dent)->lower_dentry);
+	lower_path->mnt = xcfs_lower_mnt(dent->d_sb);
+}
 /* Returns struct path.  Caller must path_put it. */
 static inline void xcfs_get_lower_path(const struct dentry *dent,
 					 struct path *lower_path)
 {
-	spin_lock(&XCFS_D(dent)->lock);
-	pathcpy(lower_path, &XCFS_D(dent)->lower_path);
+	xcfs_peek_lower_path(dent, lower_path);
 	path_get(lower_path);
-	spin_unlock(&XCFS_D(dent)->lock);
 	return;
 }
 static inline void xcfs_put_lower_path(const struct dentry *dent,
@@ -171,31 +655,25 @@ static inline void xcfs_put_lower_path(const struct dentry *dent,
 	path_put(lower_path);
 	return;
 }
+/*
+ * Takes over the lower dentry reference.  The mount reference is dropped
+ * because the superblock already pins the lower mount.
+ */
 static inline void xcfs_set_lower_path(const struct dentry *dent,
 					 struct path *lower_path)
 {
-	spin_lock(&XCFS_D(dent)->lock);
-	pathcpy(&XCFS_D(dent)->lower_path, lower_path);
-	spin_unlock(&XCFS_D(dent)->lock);
+	WRITE_ONCE(XCFS_D(dent)->lower_dentry, lower_path->dentry);
+	mntput(lower_path->mnt);
 	return;
 }
 static inline void xcfs_reset_lower_path(const struct dentry *dent)
 {
-	spin_lock(&XCFS_D(dent)->lock);
-	XCFS_D(dent)->lower_path.dentry = NULL;
-	XCFS_D(dent)->lower_path.mnt = NULL;
-	spin_unlock(&XCFS_D(dent)->lock);
+	WRITE_ONCE(XCFS_D(dent)->lower_dentry, NULL);
 	return;
 }
 static inline void xcfs_put_reset_lower_path(const struct dentry *dent)
 {
-	struct path lower_path;
-	spin_lock(&XCFS_D(dent)->lock);
-	pathcpy(&lower_path, &XCFS_D(dent)->lower_path);
-	XCFS_D(dent)->lower_path.dentry = NULL;
-	XCFS_D(dent)->lower_path.mnt = NULL;
-	spin_unlock(&XCFS_D(dent)->lock);
-	path_put(&lower_path);
+	dput(xchg(&XCFS_D(dent)->lower_dentry, NULL));
 	return;
 }
 
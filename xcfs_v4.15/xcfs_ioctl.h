@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * xcfs ioctl interface.  Included by the module and by user programs, so
+ * only fixed-size types that lay out the same on 32- and 64-bit.
+ */
+#ifndef _XCFS_IOCTL_H_
+#define _XCFS_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define XCFS_IOC_MAGIC		'x'
+
+/*
+ * XCFS_IOC_READDIRPLUS: on a directory, fill @buf with xcfs_dirent_plus
+ * records, names together with their attributes.  Start with @pos 0 and
+ * pass the returned @pos back in until XCFS_RDP_EOF is set.  "." and
+ * ".." are not returned.
+ */
+struct xcfs_dirent_plus {
+	__u64 ino;
+	__u64 size;
+	__s64 mtime_sec;
+	__u32 mtime_nsec;
+	__u32 mode;
+	__u16 reclen;		/* bytes to the next record, 8-aligned */
+	__u16 namelen;
+	__u8 type;		/* DT_* */
+	__u8 pad[3];
+	char name[];		/* NUL-terminated */
+};
+
+struct xcfs_readdirplus {
+	__u64 buf;		/* in: user buffer */
+	__u32 buf_len;		/* in: size of @buf */
+	__u32 count;		/* out: records written */
+	__s64 pos;		/* in/out: directory offset */
+	__u32 flags;		/* out: XCFS_RDP_* */
+	__u32 pad;
+};
+
+#define XCFS_RDP_EOF		0x1	/* the whole directory was read */
+
+#define XCFS_IOC_READDIRPLUS	_IOWR(XCFS_IOC_MAGIC, 1, struct xcfs_readdirplus)
+
+/*
+ * XCFS_IOC_FILESTATS: on a regular file, page cache residency of both
+ * layers and how often this inode's pages were decrypted and encrypted
+ * since it was last brought into memory.  Counts are in pages and are
+ * a snapshot; they may be stale by the time the call returns.
+ */
+struct xcfs_filestats {
+	__u64 upper_pages;	/* plaintext pages cached in xcfs */
+	__u64 upper_dirty;
+	__u64 upper_writeback;
+	__u64 lower_pages;	/* ciphertext pages cached below */
+	__u64 lower_dirty;
+	__u64 lower_writeback;
+	__u64 pages_decrypted;
+	__u64 pages_encrypted;
+};
+
+#define XCFS_IOC_FILESTATS	_IOR(XCFS_IOC_MAGIC, 2, struct xcfs_filestats)
+
+#endif	/* not _XCFS_IOCTL_H_ */
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 1998-2017 Erez Zadok
+ * Copyright (c) 2009	   Shrikar Archak
+ * Copyright (c) 2003-2017 Stony Brook University
+ * Copyright (c) 2003-2017 The Research Foundation of SUNY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * xcfs tracepoints, under events/xcfs/ in tracefs.  A disabled
+ * tracepoint is a static branch around the call, so these stay in the
+ * hot paths unless CONFIG_XCFS_TRACE is off.  Events are emitted when an
+ * operation returns and carry its result.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xcfs
+
+#if !defined(_XCFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _XCFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef CONFIG_XCFS_TRACE
+/*
+ * Built without CONFIG_XCFS_TRACE: each event below is just an empty
+ * inline trace_xcfs_*(), so callers need no #ifdefs and pay nothing.
+ */
+#undef DECLARE_EVENT_CLASS
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#undef DEFINE_EVENT
+#define DEFINE_EVENT(template, name, proto, args)			\
+	static inline void trace_##name(proto) { }
+#undef TRACE_EVENT
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)		\
+	static inline void trace_##name(proto) { }
+#endif
+
+/* inode operations on a name in a directory */
+DECLARE_EVENT_CLASS(xcfs_dir_op_class,
+	TP_PROTO(struct inode *dir, struct dentry *dentry, int err),
+	TP_ARGS(dir, dentry, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(unsigned long, ino)
+		__field(int, err)
+		__string(name, dentry->d_name.name)
+	),
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->ino = d_really_is_positive(dentry) ?
+			       d_inode(dentry)->i_ino : 0;
+		__entry->err = err;
+		__assign_str(name, dentry->d_name.name);
+	),
+	TP_printk("dev %d:%d dir %lu name %s ino %lu err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir,
+		  __get_str(name), __entry->ino, __entry->err)
+);
+
+#define DEFINE_XCFS_DIR_OP_EVENT(evt)					\
+DEFINE_EVENT(xcfs_dir_op_class, evt,					\
+	TP_PROTO(struct inode *dir, struct dentry *dentry, int err),	\
+	TP_ARGS(dir, dentry, err))
+
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_lookup);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_create);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_link);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_unlink);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_symlink);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_mkdir);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_rmdir);
+DEFINE_XCFS_DIR_OP_EVENT(xcfs_mknod);
+
+TRACE_EVENT(xcfs_rename,
+	TP_PROTO(struct inode *old_dir, struct dentry *old_dentry,
+		 struct inode *new_dir, struct dentry *new_dentry, int err),
+	TP_ARGS(old_dir, old_dentry, new_dir, new_dentry, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, old_dir)
+		__field(unsigned long, new_dir)
+		__field(int, err)
+		__string(old_name, old_dentry->d_name.name)
+		__string(new_name, new_dentry->d_name.name)
+	),
+	TP_fast_assign(
+		__entry->dev = old_dir->i_sb->s_dev;
+		__entry->old_dir = old_dir->i_ino;
+		__entry->new_dir = new_dir->i_ino;
+		__entry->err = err;
+		__assign_str(old_name, old_dentry->d_name.name);
+		__assign_str(new_name, new_dentry->d_name.name);
+	),
+	TP_printk("dev %d:%d %lu/%s -> %lu/%s err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->old_dir, __get_str(old_name),
+		  __entry->new_dir, __get_str(new_name), __entry->err)
+);
+
+TRACE_EVENT(xcfs_d_revalidate,
+	TP_PROTO(struct dentry *dentry, unsigned int flags, int ret),
+	TP_ARGS(dentry, flags, ret),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned int, flags)
+		__field(int, ret)
+		__string(name, dentry->d_name.name)
+	),
+	TP_fast_assign(
+		__entry->dev = dentry->d_sb->s_dev;
+		__entry->ino = d_really_is_positive(dentry) ?
+			       d_inode(dentry)->i_ino : 0;
+		__entry->flags = flags;
+		__entry->ret = ret;
+		__assign_str(name, dentry->d_name.name);
+	),
+	TP_printk("dev %d:%d name %s ino %lu flags 0x%x ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(name),
+		  __entry->ino, __entry->flags, __entry->ret)
+);
+
+/* inode life cycle */
+DECLARE_EVENT_CLASS(xcfs_inode_class,
+	TP_PROTO(struct inode *inode),
+	TP_ARGS(inode),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(loff_t, size)
+		__field(unsigned int, nlink)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->size = i_size_read(inode);
+		__entry->nlink = inode->i_nlink;
+	),
+	TP_printk("dev %d:%d ino %lu size %lld nlink %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->size, __entry->nlink)
+);
+
+DEFINE_EVENT(xcfs_inode_class, xcfs_evict_inode,
+	TP_PROTO(struct inode *inode),
+	TP_ARGS(inode));
+DEFINE_EVENT(xcfs_inode_class, xcfs_destroy_inode,
+	TP_PROTO(struct inode *inode),
+	TP_ARGS(inode));
+
+/* the new inode is not initialised yet; only its superblock is known */
+TRACE_EVENT(xcfs_alloc_inode,
+	TP_PROTO(struct super_block *sb, struct inode *inode),
+	TP_ARGS(sb, inode),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(bool, ok)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->ok = inode != NULL;
+	),
+	TP_printk("dev %d:%d %s", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ok ? "ok" : "ENOMEM")
+);
+
+/* @how: 0 inode hash hit, 1 icache hit, 2 new inode; negative errno */
+TRACE_EVENT(xcfs_iget,
+	TP_PROTO(struct super_block *sb, struct inode *lower_inode, int how),
+	TP_ARGS(sb, lower_inode, how),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(int, how)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->ino = lower_inode->i_ino;
+		__entry->how = how;
+	),
+	TP_printk("dev %d:%d ino %lu %s", MAJOR(__entry->dev),
+		  MINOR(__entry->dev), __entry->ino,
+		  __print_symbolic(__entry->how,
+				   { 0, "hash" }, { 1, "icache" }, { 2, "new" },
+				   { -ESTALE, "ESTALE" }, { -ENOMEM, "ENOMEM" }))
+);
+
+TRACE_EVENT(xcfs_permission,
+	TP_PROTO(struct inode *inode, int mask, int err),
+	TP_ARGS(inode, mask, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(int, mask)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->mask = mask;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu mask 0x%x err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->mask, __entry->err)
+);
+
+TRACE_EVENT(xcfs_setattr,
+	TP_PROTO(struct inode *inode, struct iattr *ia, int err),
+	TP_ARGS(inode, ia, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned int, valid)
+		__field(loff_t, size)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->valid = ia->ia_valid;
+		__entry->size = ia->ia_size;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu valid 0x%x size %lld err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->valid, __entry->size, __entry->err)
+);
+
+TRACE_EVENT(xcfs_getattr,
+	TP_PROTO(struct inode *inode, u32 mask, int err),
+	TP_ARGS(inode, mask, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(u32, mask)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->mask = mask;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu mask 0x%x err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->mask, __entry->err)
+);
+
+TRACE_EVENT(xcfs_get_link,
+	TP_PROTO(struct inode *inode, bool cached, int err),
+	TP_ARGS(inode, cached, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(bool, cached)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->cached = cached;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu cached %d err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->cached, __entry->err)
+);
+
+/* @name is "" for listxattr; @ret is a length or an errno */
+DECLARE_EVENT_CLASS(xcfs_xattr_class,
+	TP_PROTO(struct inode *inode, const char *name, size_t size,
+		 ssize_t ret),
+	TP_ARGS(inode, name, size, ret),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(size_t, size)
+		__field(ssize_t, ret)
+		__string(name, name)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->size = size;
+		__entry->ret = ret;
+		__assign_str(name, name);
+	),
+	TP_printk("dev %d:%d ino %lu name %s size %zu ret %zd",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __get_str(name), __entry->size, __entry->ret)
+);
+
+#define DEFINE_XCFS_XATTR_EVENT(evt)					\
+DEFINE_EVENT(xcfs_xattr_class, evt,					\
+	TP_PROTO(struct inode *inode, const char *name, size_t size,	\
+		 ssize_t ret),						\
+	TP_ARGS(inode, name, size, ret))
+
+DEFINE_XCFS_XATTR_EVENT(xcfs_getxattr);
+DEFINE_XCFS_XATTR_EVENT(xcfs_setxattr);
+DEFINE_XCFS_XATTR_EVENT(xcfs_listxattr);
+DEFINE_XCFS_XATTR_EVENT(xcfs_removexattr);
+
+/* file operations without a byte range */
+DECLARE_EVENT_CLASS(xcfs_file_class,
+	TP_PROTO(struct inode *inode, struct file *file, int err),
+	TP_ARGS(inode, file, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned int, flags)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->flags = file->f_flags;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu flags 0%o err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->flags, __entry->err)
+);
+
+#define DEFINE_XCFS_FILE_EVENT(evt)					\
+DEFINE_EVENT(xcfs_file_class, evt,					\
+	TP_PROTO(struct inode *inode, struct file *file, int err),	\
+	TP_ARGS(inode, file, err))
+
+DEFINE_XCFS_FILE_EVENT(xcfs_open);
+DEFINE_XCFS_FILE_EVENT(xcfs_release);
+DEFINE_XCFS_FILE_EVENT(xcfs_flush);
+DEFINE_XCFS_FILE_EVENT(xcfs_mmap);
+
+TRACE_EVENT(xcfs_ioctl,
+	TP_PROTO(struct inode *inode, unsigned int cmd, long ret),
+	TP_ARGS(inode, cmd, ret),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned int, cmd)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+	TP_printk("dev %d:%d ino %lu cmd 0x%x ret %ld",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->cmd, __entry->ret)
+);
+
+/* byte ranges: @ret is the bytes done or an errno */
+DECLARE_EVENT_CLASS(xcfs_rw_class,
+	TP_PROTO(struct inode *inode, loff_t pos, size_t len, ssize_t ret),
+	TP_ARGS(inode, pos, len, ret),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(loff_t, pos)
+		__field(size_t, len)
+		__field(ssize_t, ret)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->pos = pos;
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+	TP_printk("dev %d:%d ino %lu pos %lld len %zu ret %zd",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->pos, __entry->len, __entry->ret)
+);
+
+#define DEFINE_XCFS_RW_EVENT(evt)					\
+DEFINE_EVENT(xcfs_rw_class, evt,					\
+	TP_PROTO(struct inode *inode, loff_t pos, size_t len,		\
+		 ssize_t ret),						\
+	TP_ARGS(inode, pos, len, ret))
+
+DEFINE_XCFS_RW_EVENT(xcfs_read_iter);
+DEFINE_XCFS_RW_EVENT(xcfs_write_iter);
+DEFINE_XCFS_RW_EVENT(xcfs_write_begin);
+DEFINE_XCFS_RW_EVENT(xcfs_write_end);
+DEFINE_XCFS_RW_EVENT(xcfs_fsync);
+/* @pos is the starting directory position, @len how far it moved */
+DEFINE_XCFS_RW_EVENT(xcfs_readdir);
+
+/* address space operations on one page */
+DECLARE_EVENT_CLASS(xcfs_page_class,
+	TP_PROTO(struct inode *inode, struct page *page, int err),
+	TP_ARGS(inode, page, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(pgoff_t, index)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->index = page->index;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d ino %lu index %lu err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->index, __entry->err)
+);
+
+DEFINE_EVENT(xcfs_page_class, xcfs_readpage,
+	TP_PROTO(struct inode *inode, struct page *page, int err),
+	TP_ARGS(inode, page, err));
+DEFINE_EVENT(xcfs_page_class, xcfs_writepage,
+	TP_PROTO(struct inode *inode, struct page *page, int err),
+	TP_ARGS(inode, page, err));
+
+/* superblock operations */
+DECLARE_EVENT_CLASS(xcfs_super_class,
+	TP_PROTO(struct super_block *sb, int flags, int err),
+	TP_ARGS(sb, flags, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(int, flags)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->flags = flags;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d flags 0x%x err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->flags,
+		  __entry->err)
+);
+
+#define DEFINE_XCFS_SUPER_EVENT(evt)					\
+DEFINE_EVENT(xcfs_super_class, evt,					\
+	TP_PROTO(struct super_block *sb, int flags, int err),		\
+	TP_ARGS(sb, flags, err))
+
+DEFINE_XCFS_SUPER_EVENT(xcfs_read_super);
+DEFINE_XCFS_SUPER_EVENT(xcfs_put_super);
+DEFINE_XCFS_SUPER_EVENT(xcfs_remount_fs);
+
+TRACE_EVENT(xcfs_statfs,
+	TP_PROTO(struct super_block *sb, bool cached, int err),
+	TP_ARGS(sb, cached, err),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(bool, cached)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->cached = cached;
+		__entry->err = err;
+	),
+	TP_printk("dev %d:%d cached %d err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->cached,
+		  __entry->err)
+);
+
+#ifndef CONFIG_XCFS_TRACE
+/* back to the <linux/tracepoint.h> definitions for later headers */
+#undef DECLARE_EVENT_CLASS
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#undef DEFINE_EVENT
+#define DEFINE_EVENT(template, name, proto, args)			\
+	DECLARE_TRACE(name, PARAMS(proto), PARAMS(args))
+#undef TRACE_EVENT
+#define TRACE_EVENT(name, proto, args, struct, assign, print)		\
+	DECLARE_TRACE(name, PARAMS(proto), PARAMS(args))
+#endif
+
+#endif /* _XCFS_TRACE_H */
+
+#ifdef CONFIG_XCFS_TRACE
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xcfs_trace
+#include <trace/define_trace.h>
+#endif